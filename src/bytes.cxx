@@ -3,9 +3,126 @@
 #include <fstream>
 #include <iterator>
 
+#ifdef _WIN32
+    #define WIN32_LEAN_AND_MEAN
+    #define NOMINMAX
+    #include <Windows.h>
+#else
+    #include <fcntl.h>
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+    #include <unistd.h>
+#endif
+
 using namespace rstc;
 
 Bytes::Bytes(std::filesystem::path const &path)
+{
+    if (!map(path)) {
+        read(path);
+    }
+}
+
+Bytes::~Bytes()
+{
+    unmap();
+}
+
+Bytes::Container::value_type const *Bytes::data() const
+{
+    return mapping_ ? mapping_ : bytes_.data();
+}
+
+size_t Bytes::size() const
+{
+    return mapping_ ? mapping_size_ : bytes_.size();
+}
+
+#ifdef _WIN32
+
+bool Bytes::map(std::filesystem::path const &path)
+{
+    HANDLE file = CreateFileW(path.c_str(),
+                              GENERIC_READ,
+                              FILE_SHARE_READ,
+                              nullptr,
+                              OPEN_EXISTING,
+                              FILE_ATTRIBUTE_NORMAL | FILE_FLAG_RANDOM_ACCESS,
+                              nullptr);
+    if (file == INVALID_HANDLE_VALUE) {
+        return false;
+    }
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(file, &size) || size.QuadPart == 0) {
+        CloseHandle(file);
+        return false;
+    }
+    HANDLE mapping =
+        CreateFileMappingW(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    CloseHandle(file);
+    if (!mapping) {
+        return false;
+    }
+    // The view keeps the mapping object alive.
+    auto view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    CloseHandle(mapping);
+    if (!view) {
+        return false;
+    }
+    mapping_ = static_cast<Byte const *>(view);
+    mapping_size_ = static_cast<size_t>(size.QuadPart);
+    return true;
+}
+
+void Bytes::unmap()
+{
+    if (mapping_) {
+        UnmapViewOfFile(mapping_);
+        mapping_ = nullptr;
+        mapping_size_ = 0;
+    }
+}
+
+#else
+
+bool Bytes::map(std::filesystem::path const &path)
+{
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd == -1) {
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) == -1 || st.st_size == 0) {
+        close(fd);
+        return false;
+    }
+    auto size = static_cast<size_t>(st.st_size);
+    void *view = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+    // The mapping keeps the file referenced.
+    close(fd);
+    if (view == MAP_FAILED) {
+        return false;
+    }
+    // Code is visited by following control flow, not sequentially,
+    // so read-ahead of the whole image is mostly wasted.
+    madvise(view, size, MADV_RANDOM);
+    mapping_ = static_cast<Byte const *>(view);
+    mapping_size_ = size;
+    return true;
+}
+
+void Bytes::unmap()
+{
+    if (mapping_) {
+        munmap(const_cast<Byte *>(mapping_), mapping_size_);
+        mapping_ = nullptr;
+        mapping_size_ = 0;
+    }
+}
+
+#endif
+
+void Bytes::read(std::filesystem::path const &path)
 {
     std::ifstream file;
     file.exceptions(std::ios::badbit | std::ios::failbit);
@@ -16,8 +133,3 @@ Bytes::Bytes(std::filesystem::path const &path)
     file.seekg(0, std::ios::beg);
     file.read(reinterpret_cast<char *>(bytes_.data()), bytes_.size());
 }
-
-Bytes::Container::value_type const *Bytes::data() const
-{
-    return bytes_.data();
-}
@@ -8,15 +8,35 @@
 
 namespace rstc {
 
+    // Read-only view of a file.
+    // The file is memory-mapped when possible, so the pointers into it
+    // stay valid for the lifetime of `Bytes` and pages are shared between
+    // processes analyzing the same file. Otherwise the file is read into
+    // a buffer.
     class Bytes {
     public:
         using Container = std::vector<Byte>;
 
         Bytes(std::filesystem::path const &path);
+        ~Bytes();
+
+        Bytes(Bytes const &) = delete;
+        Bytes(Bytes &&) = delete;
+        Bytes &operator=(Bytes const &) = delete;
+        Bytes &operator=(Bytes &&) = delete;
 
         Container::value_type const *data() const;
+        size_t size() const;
+
+        inline bool is_mapped() const { return mapping_ != nullptr; }
 
     private:
+        bool map(std::filesystem::path const &path);
+        void unmap();
+        void read(std::filesystem::path const &path);
+
+        Byte const *mapping_ = nullptr;
+        size_t mapping_size_ = 0;
         Container bytes_;
     };
 
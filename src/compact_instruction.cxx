@@ -0,0 +1,84 @@
+#include "compact_instruction.hxx"
+
+#include "zyan_error.hxx"
+
+#include <algorithm>
+
+using namespace rstc;
+
+namespace {
+
+    ZydisDecoder const &get_decoder()
+    {
+        static ZydisDecoder const decoder = [] {
+            ZydisDecoder decoder;
+            ZYAN_THROW(ZydisDecoderInit(&decoder,
+                                        ZYDIS_MACHINE_MODE_LONG_64,
+                                        ZYDIS_ADDRESS_WIDTH_64));
+            return decoder;
+        }();
+        return decoder;
+    }
+
+    void copy_operand(CompactOperand &dst, ZydisDecodedOperand const &src)
+    {
+        dst.type = src.type;
+        dst.visibility = src.visibility;
+        dst.actions = src.actions;
+        dst.size = src.size;
+        dst.element_type = src.element_type;
+        dst.element_size = src.element_size;
+        dst.reg.value = src.reg.value;
+        dst.mem.segment = src.mem.segment;
+        dst.mem.base = src.mem.base;
+        dst.mem.index = src.mem.index;
+        dst.mem.scale = src.mem.scale;
+        dst.mem.disp.has_displacement = src.mem.disp.has_displacement;
+        dst.mem.disp.value = src.mem.disp.value;
+        dst.imm.is_signed = src.imm.is_signed;
+        dst.imm.is_relative = src.imm.is_relative;
+        dst.imm.value.u = src.imm.value.u;
+    }
+
+}
+
+CompactInstruction const *
+CompactInstruction::make(utils::Arena &arena,
+                         ZydisDecodedInstruction const &instruction,
+                         ZyanU8 const *bytes)
+{
+    auto operands =
+        arena.make_array<CompactOperand>(instruction.operand_count);
+    for (ZyanU8 i = 0; i < instruction.operand_count; i++) {
+        copy_operand(operands[i], instruction.operands[i]);
+    }
+    auto compact = arena.make<CompactInstruction>();
+    compact->operands = operands;
+    compact->mnemonic = instruction.mnemonic;
+    compact->length = instruction.length;
+    compact->operand_count = instruction.operand_count;
+    std::copy_n(bytes, instruction.length, compact->bytes.begin());
+    return compact;
+}
+
+CompactInstruction const *
+CompactInstruction::copy(utils::Arena &arena,
+                         CompactInstruction const &instruction)
+{
+    auto operands =
+        arena.make_array<CompactOperand>(instruction.operand_count);
+    std::copy_n(instruction.operands, instruction.operand_count, operands);
+    auto compact = arena.make<CompactInstruction>(instruction);
+    compact->operands = operands;
+    return compact;
+}
+
+ZydisDecodedInstruction CompactInstruction::decode() const
+{
+    ZydisDecodedInstruction instruction;
+    ZYAN_THROW(ZydisDecoderDecodeBuffer(&get_decoder(),
+                                        bytes.data(),
+                                        length,
+                                        &instruction));
+    return instruction;
+}
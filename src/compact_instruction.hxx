@@ -0,0 +1,64 @@
+#pragma once
+
+#include "utils/arena.hxx"
+
+#include <Zydis/Zydis.h>
+
+#include <array>
+
+namespace rstc {
+
+    // Subset of `ZydisDecodedOperand` read by the analysis.
+    // Field names match Zydis, so both can be used interchangeably.
+    struct CompactOperand {
+        ZydisOperandType type;
+        ZydisOperandVisibility visibility;
+        ZydisOperandActions actions;
+        ZyanU16 size;
+        ZydisElementType element_type;
+        ZydisElementSize element_size;
+        struct {
+            ZydisRegister value;
+        } reg;
+        struct {
+            ZydisRegister segment;
+            ZydisRegister base;
+            ZydisRegister index;
+            ZyanU8 scale;
+            struct {
+                ZyanBool has_displacement;
+                ZyanI64 value;
+            } disp;
+        } mem;
+        struct {
+            ZyanBool is_signed;
+            ZyanBool is_relative;
+            union {
+                ZyanU64 u;
+                ZyanI64 s;
+            } value;
+        } imm;
+    };
+
+    // Subset of `ZydisDecodedInstruction` read by the analysis.
+    // Operands are allocated right after the instruction in the same arena,
+    // only `operand_count` of them are stored. Raw bytes are kept to
+    // re-decode the full instruction, e.g. for formatting.
+    struct CompactInstruction {
+        static CompactInstruction const *
+        make(utils::Arena &arena,
+             ZydisDecodedInstruction const &instruction,
+             ZyanU8 const *bytes);
+        static CompactInstruction const *
+        copy(utils::Arena &arena, CompactInstruction const &instruction);
+
+        ZydisDecodedInstruction decode() const;
+
+        CompactOperand const *operands;
+        ZydisMnemonic mnemonic;
+        ZyanU8 length;
+        ZyanU8 operand_count;
+        std::array<ZyanU8, ZYDIS_MAX_INSTRUCTION_LENGTH> bytes;
+    };
+
+}
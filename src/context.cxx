@@ -10,10 +10,10 @@
 
 using namespace rstc;
 
-Context::Context(std::nullptr_t)
+Context::Context(std::nullptr_t, utils::Pool *pool)
     : hash_(0)
-    , registers_()
-    , memory_(nullptr)
+    , registers_(nullptr, pool)
+    , memory_(nullptr, pool)
 {
     for (auto const &[zydis_reg, reg] : virt::Registers::register_map) {
         set_register(zydis_reg, virt::make_symbolic_value(nullptr));
@@ -27,6 +27,13 @@ Context::Context(Context const *parent)
 {
 }
 
+Context::Context(Context const &other, utils::Pool *pool)
+    : hash_(other.hash_)
+    , registers_(other.registers_, pool)
+    , memory_(other.memory_, pool)
+{
+}
+
 std::optional<virt::Value> Context::get_register(ZydisRegister reg) const
 {
     return registers_.get(reg);
@@ -39,33 +46,17 @@ Context::MemoryValues Context::get_memory(uintptr_t address, size_t size) const
 
 void Context::set_register(ZydisRegister reg, virt::Value value)
 {
-    if (!registers_.is_tracked(reg)) {
+    auto tracked = virt::Registers::from_zydis(reg);
+    if (!tracked) {
         return;
     }
-    if (auto old = get_register(reg); old) {
-        utils::hash::reverse(hash_, old->source());
-        if (old->is_symbolic()) {
-            utils::hash::reverse(hash_, old->symbol().offset());
-            utils::hash::reverse(hash_, old->symbol().id());
-        }
-        else {
-            utils::hash::reverse(hash_, old->value());
-        }
-        // Don't "un"-hash `reg`,
-        // as we will hash it only if old value didn't exist
-    }
-    else {
-        utils::hash::combine(hash_, reg);
-    }
-    if (value.is_symbolic()) {
-        utils::hash::combine(hash_, value.symbol().id());
-        utils::hash::combine(hash_, value.symbol().offset());
-    }
-    else {
-        utils::hash::combine(hash_, value.value());
+    // Registers are mixed into the hash independently of the order of
+    // writes, so contexts with the same registers have the same hash
+    if (auto old = registers_.get(reg); old) {
+        utils::hash::mix(hash_, hash_register(*tracked, *old));
     }
-    utils::hash::combine(hash_, value.source());
     registers_.set(reg, value);
+    utils::hash::mix(hash_, hash_register(*tracked, *registers_.get(reg)));
 }
 
 void Context::set_memory(uintptr_t address, virt::Value value)
@@ -73,6 +64,18 @@ void Context::set_memory(uintptr_t address, virt::Value value)
     memory_.set(address, value);
 }
 
+size_t Context::hash_register(virt::Registers::Reg reg,
+                              virt::Value const &value)
+{
+    size_t hash = reg;
+    utils::hash::combine(hash, value.raw_address_value());
+    if (value.is_symbolic()) {
+        utils::hash::combine(hash, value.symbol().offset());
+    }
+    utils::hash::combine(hash, value.source());
+    return hash;
+}
+
 Context Context::make_child() const
 {
     return Context(this);
@@ -5,6 +5,8 @@
 #include "virtual/memory.hxx"
 #include "virtual/registers.hxx"
 
+#include "utils/pool.hxx"
+
 #include <Zydis/Zydis.h>
 
 #include <memory>
@@ -18,8 +20,13 @@ namespace rstc {
         using MemoryValues = virt::Memory::Values;
 
         Context() = delete;
-        Context(std::nullptr_t);
+        // Registers and memory of the context and its children
+        // are allocated from `pool`, or from the heap if there is none
+        Context(std::nullptr_t, utils::Pool *pool = nullptr);
         Context(Context const *parent);
+        // Deep copy allocated from `pool`, which shares nothing with
+        // `other` and can be handed over to another thread
+        Context(Context const &other, utils::Pool *pool);
 
         Context(Context const &) = delete;
         Context(Context &&other) = default;
@@ -51,6 +58,9 @@ namespace rstc {
         inline size_t get_hash() const { return hash_; }
 
     private:
+        static size_t hash_register(virt::Registers::Reg reg,
+                                    virt::Value const &value);
+
         size_t hash_;
         virt::Registers registers_;
         virt::Memory memory_;
@@ -0,0 +1,31 @@
+#include "contexts.hxx"
+
+#include <algorithm>
+#include <iterator>
+
+using namespace rstc;
+
+FloContexts::FloContexts(Discovered &&discovered)
+{
+    contexts_.reserve(discovered.size());
+    for (auto it = discovered.begin(); it != discovered.end(); ++it) {
+        if (addresses_.empty() || addresses_.back() != it->first) {
+            addresses_.push_back(it->first);
+            offsets_.push_back(static_cast<uint32_t>(contexts_.size()));
+        }
+        contexts_.push_back(std::move(it->second));
+    }
+    offsets_.push_back(static_cast<uint32_t>(contexts_.size()));
+    discovered.clear();
+}
+
+std::span<Context const> FloContexts::get(Address address) const
+{
+    auto it = std::lower_bound(addresses_.begin(), addresses_.end(), address);
+    if (it == addresses_.end() || *it != address) {
+        return {};
+    }
+    auto index = std::distance(addresses_.begin(), it);
+    return std::span<Context const>(contexts_.data() + offsets_[index],
+                                    contexts_.data() + offsets_[index + 1]);
+}
@@ -2,8 +2,12 @@
 
 #include "context.hxx"
 
+#include <cstdint>
+#include <map>
 #include <set>
+#include <span>
 #include <unordered_map>
+#include <vector>
 
 namespace rstc {
 
@@ -61,4 +65,32 @@ namespace rstc {
         Container container_;
     };
 
+    // Contexts of a flo by instruction address, frozen after the analysis:
+    // sorted addresses, offsets into the contiguous array of contexts.
+    class FloContexts {
+    public:
+        // Filled during the analysis
+        using Discovered = std::multimap<Address, Context>;
+
+        FloContexts() = default;
+        explicit FloContexts(Discovered &&discovered);
+
+        FloContexts(FloContexts const &) = delete;
+        FloContexts(FloContexts &&other) = default;
+
+        FloContexts &operator=(FloContexts const &) = delete;
+        FloContexts &operator=(FloContexts &&rhs) = default;
+
+        std::span<Context const> get(Address address) const;
+
+        inline bool empty() const { return contexts_.empty(); }
+        inline size_t size() const { return contexts_.size(); }
+
+    private:
+        std::vector<Address> addresses_;
+        // Contexts of addresses_[i] are [offsets_[i]; offsets_[i + 1])
+        std::vector<uint32_t> offsets_;
+        std::vector<Context> contexts_;
+    };
+
 }
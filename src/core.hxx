@@ -2,12 +2,26 @@
 
 #include <Zydis/Zydis.h>
 
+#ifdef RSTC_COMPACT_INSTRUCTIONS
+    #include "compact_instruction.hxx"
+#endif
+
 #include <memory>
 
 namespace rstc {
 
     using Byte = unsigned char;
     using Address = Byte const *;
-    using Instruction = std::unique_ptr<ZydisDecodedInstruction>;
+
+#ifdef RSTC_COMPACT_INSTRUCTIONS
+    using DecodedInstruction = CompactInstruction;
+    using DecodedOperand = CompactOperand;
+#else
+    using DecodedInstruction = ZydisDecodedInstruction;
+    using DecodedOperand = ZydisDecodedOperand;
+#endif
+
+    // Owned by the flo's instruction arena
+    using Instruction = DecodedInstruction const *;
 
 }
@@ -0,0 +1,127 @@
+#include "decode_cache.hxx"
+
+#include "flo.hxx"
+#include "zyan_error.hxx"
+
+#include <algorithm>
+#include <numeric>
+
+using namespace rstc;
+
+DecodeCache::DecodeCache(PE const &pe, Executor &executor, size_t chunk_size)
+{
+    ZYAN_THROW(ZydisDecoderInit(&decoder_,
+                                ZYDIS_MACHINE_MODE_LONG_64,
+                                ZYDIS_ADDRESS_WIDTH_64));
+    for (auto const &section : pe.image_sections()) {
+        if (!(section.Characteristics & IMAGE_SCN_MEM_EXECUTE)) {
+            continue;
+        }
+        Address begin = pe.data() + section.PointerToRawData;
+        Address end =
+            begin + std::min(section.SizeOfRawData, section.Misc.VirtualSize);
+        for (Address chunk = begin; chunk < end; chunk += chunk_size) {
+            chunks_.emplace_back(chunk,
+                                 std::min<Address>(chunk + chunk_size, end),
+                                 end);
+        }
+    }
+    std::sort(chunks_.begin(),
+              chunks_.end(),
+              [](Chunk const &a, Chunk const &b) { return a.begin < b.begin; });
+    for (auto &chunk : chunks_) {
+        executor.submit([this, &chunk] { sweep(chunk); });
+    }
+    executor.wait();
+    // Resync reads the next chunk and appends to the current one,
+    // so neighbouring chunks are never resynced at the same time.
+    for (size_t parity = 0; parity < 2; parity++) {
+        for (size_t i = parity; i + 1 < chunks_.size(); i += 2) {
+            if (chunks_[i].section_end != chunks_[i + 1].section_end) {
+                continue;
+            }
+            executor.submit([this, i] { resync(chunks_[i], chunks_[i + 1]); });
+        }
+        executor.wait();
+    }
+}
+
+Instruction DecodeCache::find(Address address) const
+{
+    auto it = std::upper_bound(
+        chunks_.begin(),
+        chunks_.end(),
+        address,
+        [](Address address, Chunk const &chunk) {
+            return address < chunk.begin;
+        });
+    if (it == chunks_.begin()) {
+        return nullptr;
+    }
+    --it;
+    if (auto instruction = find(*it, address); instruction) {
+        return instruction;
+    }
+    // Resync of the previous chunk might have reached the address
+    if (it != chunks_.begin()) {
+        return find(*std::prev(it), address);
+    }
+    return nullptr;
+}
+
+size_t DecodeCache::size() const
+{
+    return std::accumulate(chunks_.begin(),
+                           chunks_.end(),
+                           size_t(0),
+                           [](size_t size, Chunk const &chunk) {
+                               return size + chunk.addresses.size();
+                           });
+}
+
+void DecodeCache::sweep(Chunk &chunk)
+{
+    Address address = chunk.begin;
+    while (address < chunk.end) {
+        address = decode(chunk, address);
+    }
+}
+
+void DecodeCache::resync(Chunk &chunk, Chunk const &next)
+{
+    if (chunk.addresses.empty()) {
+        return;
+    }
+    Address address =
+        chunk.addresses.back() + chunk.instructions.back()->length;
+    while (address < next.end && !find(next, address)) {
+        address = decode(chunk, address);
+    }
+}
+
+Address DecodeCache::decode(Chunk &chunk, Address address)
+{
+    ZydisDecodedInstruction instruction;
+    if (ZYAN_FAILED(ZydisDecoderDecodeBuffer(&decoder_,
+                                             address,
+                                             chunk.section_end - address,
+                                             &instruction))) {
+        // Data or padding, skip a byte
+        return address + 1;
+    }
+    chunk.addresses.push_back(address);
+    chunk.instructions.push_back(
+        Flo::make_instruction(chunk.arena, address, instruction));
+    return address + instruction.length;
+}
+
+Instruction DecodeCache::find(Chunk const &chunk, Address address)
+{
+    auto it = std::lower_bound(chunk.addresses.begin(),
+                               chunk.addresses.end(),
+                               address);
+    if (it == chunk.addresses.end() || *it != address) {
+        return nullptr;
+    }
+    return chunk.instructions[std::distance(chunk.addresses.begin(), it)];
+}
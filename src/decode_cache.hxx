@@ -0,0 +1,65 @@
+#pragma once
+
+#include "core.hxx"
+#include "executor.hxx"
+#include "pe.hxx"
+
+#include "utils/arena.hxx"
+
+#include <Zydis/Zydis.h>
+
+#include <vector>
+
+namespace rstc {
+
+    // Instructions of executable sections, decoded ahead of discovery.
+    // Sections are split into chunks which are linearly swept in parallel.
+    // A sweep which starts in the middle of an instruction re-synchronises
+    // by itself after a few instructions, so each chunk is then continued
+    // past its end until it meets an instruction boundary of the next chunk.
+    // An entry is a decoding of the bytes at its address, regardless of how
+    // the sweep got there, so it is valid even if the sweep was misaligned.
+    // Flos copy the entries they use, so the cache only lives as long as
+    // discovery does.
+    class DecodeCache {
+    public:
+        DecodeCache(PE const &pe,
+                    Executor &executor,
+                    size_t chunk_size = 64 * 1024);
+
+        DecodeCache(DecodeCache const &) = delete;
+        DecodeCache &operator=(DecodeCache const &) = delete;
+
+        // Returns nullptr on a miss
+        Instruction find(Address address) const;
+        size_t size() const;
+
+    private:
+        struct Chunk {
+            Chunk(Address begin, Address end, Address section_end)
+                : begin(begin)
+                , end(end)
+                , section_end(section_end)
+            {
+            }
+
+            Address begin;
+            Address end;
+            Address section_end;
+            utils::Arena arena;
+            // Sorted, instructions past `end` are appended by the resync
+            std::vector<Address> addresses;
+            std::vector<Instruction> instructions;
+        };
+
+        void sweep(Chunk &chunk);
+        void resync(Chunk &chunk, Chunk const &next);
+        // Returns the address of the next instruction
+        Address decode(Chunk &chunk, Address address);
+        static Instruction find(Chunk const &chunk, Address address);
+
+        ZydisDecoder decoder_;
+        std::vector<Chunk> chunks_;
+    };
+
+}
@@ -41,6 +41,15 @@ void Dumper::dump_instruction(std::ostream &os,
     os.flags(flags);
 }
 
+#ifdef RSTC_COMPACT_INSTRUCTIONS
+void Dumper::dump_instruction(std::ostream &os,
+                              DWORD va,
+                              CompactInstruction const &instruction) const
+{
+    dump_instruction(os, va, instruction.decode());
+}
+#endif
+
 void Dumper::dump_value(std::ostream &os, virt::Value const &value) const
 {
     auto flags = os.flags();
@@ -18,6 +18,11 @@ namespace rstc {
         void dump_instruction(std::ostream &os,
                               DWORD va,
                               ZydisDecodedInstruction const &instruction) const;
+#ifdef RSTC_COMPACT_INSTRUCTIONS
+        void dump_instruction(std::ostream &os,
+                              DWORD va,
+                              CompactInstruction const &instruction) const;
+#endif
         void dump_value(std::ostream &os, virt::Value const &value) const;
 
     private:
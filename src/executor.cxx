@@ -0,0 +1,152 @@
+#include "executor.hxx"
+
+#include <algorithm>
+#include <cassert>
+
+using namespace rstc;
+
+thread_local Executor *Executor::current_executor_ = nullptr;
+thread_local size_t Executor::current_worker_ = 0;
+
+Executor::Executor(size_t workers_count)
+    : workers_count_(std::max<size_t>(workers_count, 1))
+{
+}
+
+Executor::~Executor()
+{
+    wait();
+    stop();
+}
+
+void Executor::submit(Task task)
+{
+    if (!started_) {
+        start();
+    }
+    ++pending_tasks_count_;
+    if (current_executor_ == this) {
+        push_task(current_worker_, std::move(task));
+    }
+    else {
+        push_task(next_worker_++ % workers_.size(), std::move(task));
+    }
+}
+
+void Executor::wait()
+{
+    assert(current_executor_ != this);
+    auto lock = std::unique_lock(mutex_);
+    idle_cv_.wait(lock, [this] { return pending_tasks_count_ == 0; });
+}
+
+void Executor::set_workers_count(size_t amount)
+{
+    wait();
+    stop();
+    workers_count_ = std::max<size_t>(amount, 1);
+}
+
+void Executor::start()
+{
+    std::scoped_lock<std::mutex> start_guard(mutex_);
+    if (started_) {
+        return;
+    }
+    stopping_ = false;
+    workers_.reserve(workers_count_);
+    for (size_t i = 0; i < workers_count_; i++) {
+        workers_.push_back(std::make_unique<Worker>());
+    }
+    threads_.reserve(workers_count_);
+    for (size_t i = 0; i < workers_count_; i++) {
+        threads_.emplace_back(&Executor::run, this, i);
+    }
+    started_ = true;
+}
+
+void Executor::stop()
+{
+    {
+        std::scoped_lock<std::mutex> stop_guard(mutex_);
+        stopping_ = true;
+    }
+    tasks_cv_.notify_all();
+    for (auto &thread : threads_) {
+        thread.join();
+    }
+    threads_.clear();
+    workers_.clear();
+    started_ = false;
+}
+
+void Executor::run(size_t index)
+{
+    current_executor_ = this;
+    current_worker_ = index;
+    Task task;
+    while (true) {
+        if (pop_task(index, task) || steal_task(index, task)) {
+            task();
+            task = nullptr;
+            if (--pending_tasks_count_ == 0) {
+                std::scoped_lock<std::mutex> notify_guard(mutex_);
+                idle_cv_.notify_all();
+            }
+            continue;
+        }
+        auto lock = std::unique_lock(mutex_);
+        tasks_cv_.wait(lock, [this] {
+            return stopping_ || queued_tasks_count_ > 0;
+        });
+        if (stopping_ && queued_tasks_count_ == 0) {
+            break;
+        }
+    }
+    current_executor_ = nullptr;
+}
+
+bool Executor::pop_task(size_t index, Task &task)
+{
+    auto &worker = *workers_[index];
+    std::scoped_lock<std::mutex> pop_guard(worker.mutex);
+    if (worker.tasks.empty()) {
+        return false;
+    }
+    task = std::move(worker.tasks.back());
+    worker.tasks.pop_back();
+    --queued_tasks_count_;
+    return true;
+}
+
+bool Executor::steal_task(size_t index, Task &task)
+{
+    for (size_t i = 1; i < workers_.size(); i++) {
+        auto &victim = *workers_[(index + i) % workers_.size()];
+        std::scoped_lock<std::mutex> steal_guard(victim.mutex);
+        if (victim.tasks.empty()) {
+            continue;
+        }
+        task = std::move(victim.tasks.front());
+        victim.tasks.pop_front();
+        --queued_tasks_count_;
+        return true;
+    }
+    return false;
+}
+
+void Executor::push_task(size_t index, Task &&task)
+{
+    auto &worker = *workers_[index];
+    {
+        std::scoped_lock<std::mutex> push_guard(worker.mutex);
+        worker.tasks.push_back(std::move(task));
+        ++queued_tasks_count_;
+    }
+    {
+        // Pairs with the predicate check in `run`, so that a worker
+        // which is about to sleep cannot miss the notification.
+        std::scoped_lock<std::mutex> notify_guard(mutex_);
+    }
+    tasks_cv_.notify_one();
+}
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace rstc {
+
+    // Fixed pool of workers with per-worker task deques.
+    // Workers pop their own tasks LIFO and steal others' tasks FIFO.
+    // Tasks submitted from a worker go to that worker's deque,
+    // tasks submitted from outside are distributed round-robin.
+    class Executor {
+    public:
+        using Task = std::function<void()>;
+
+        explicit Executor(
+            size_t workers_count = std::thread::hardware_concurrency());
+        ~Executor();
+
+        Executor(Executor const &) = delete;
+        Executor(Executor &&) = delete;
+        Executor &operator=(Executor const &) = delete;
+        Executor &operator=(Executor &&) = delete;
+
+        void submit(Task task);
+        // Blocks until all submitted tasks (including tasks submitted by
+        // tasks) are finished. Must not be called from a worker.
+        void wait();
+
+        // Waits for the pending tasks and restarts the pool
+        // with the new amount of workers.
+        void set_workers_count(size_t amount);
+        inline size_t workers_count() const { return workers_count_; }
+
+    private:
+        struct Worker {
+            std::mutex mutex;
+            std::deque<Task> tasks;
+        };
+
+        void start();
+        void stop();
+        void run(size_t index);
+        bool pop_task(size_t index, Task &task);
+        bool steal_task(size_t index, Task &task);
+        void push_task(size_t index, Task &&task);
+
+        size_t workers_count_;
+        std::vector<std::unique_ptr<Worker>> workers_;
+        std::vector<std::thread> threads_;
+
+        std::mutex mutex_;
+        std::condition_variable tasks_cv_;
+        std::condition_variable idle_cv_;
+        bool stopping_ = false;
+        std::atomic<bool> started_ = false;
+        std::atomic<size_t> queued_tasks_count_ = 0;
+        std::atomic<size_t> pending_tasks_count_ = 0;
+        std::atomic<size_t> next_worker_ = 0;
+
+        static thread_local Executor *current_executor_;
+        static thread_local size_t current_worker_;
+    };
+
+}
@@ -2,10 +2,44 @@
 
 #include "utils/adapters.hxx"
 
+#include <algorithm>
 #include <iterator>
+#include <stdexcept>
 
 using namespace rstc;
 
+Disassembly::Disassembly(DiscoveredDisassembly const &disassembly)
+{
+    addresses_.reserve(disassembly.size());
+    instructions_.reserve(disassembly.size());
+    for (auto const &[address, instruction] : disassembly) {
+        addresses_.push_back(address);
+        instructions_.push_back(instruction);
+    }
+}
+
+Disassembly::const_iterator Disassembly::lower_bound(Address address) const
+{
+    auto it = std::lower_bound(addresses_.begin(), addresses_.end(), address);
+    return begin() + std::distance(addresses_.begin(), it);
+}
+
+Disassembly::const_iterator Disassembly::find(Address address) const
+{
+    if (auto it = lower_bound(address); it != end() && it->first == address) {
+        return it;
+    }
+    return end();
+}
+
+Instruction Disassembly::at(Address address) const
+{
+    if (auto it = find(address); it != end()) {
+        return it->second;
+    }
+    throw std::out_of_range("address is not disassembled");
+}
+
 Flo::Flo(PE const &pe,
          Address entry_point,
          Address reference,
@@ -17,16 +51,39 @@ Flo::Flo(PE const &pe,
     add_reference(reference);
 }
 
+Flo::AnalysisResult Flo::analyze(Address address,
+                                 ZydisDecodedInstruction const &instr)
+{
+    if (should_be_unreachable(instr.mnemonic)) {
+        return { Unreachable, nullptr };
+    }
+    assert(!frozen_);
+    auto [it, inserted] = discovered_disassembly_.emplace(address, nullptr);
+    if (!inserted) {
+        return { AlreadyAnalyzed, nullptr };
+    }
+    it->second = make_instruction(instructions_arena_, address, instr);
+    return analyze_inserted(address, *it->second);
+}
+
 Flo::AnalysisResult Flo::analyze(Address address, Instruction instr)
 {
-    if (should_be_unreachable(*instr)) {
+    if (should_be_unreachable(instr->mnemonic)) {
         return { Unreachable, nullptr };
     }
-    auto [it, inserted] = disassembly_.emplace(address, std::move(instr));
+    assert(!frozen_);
+    auto [it, inserted] = discovered_disassembly_.emplace(address, nullptr);
     if (!inserted) {
         return { AlreadyAnalyzed, nullptr };
     }
-    auto const &instruction = *it->second;
+    // The decode cache is dropped once discovery is done
+    it->second = make_instruction(instructions_arena_, *instr);
+    return analyze_inserted(address, *it->second);
+}
+
+Flo::AnalysisResult
+Flo::analyze_inserted(Address address, DecodedInstruction const &instruction)
+{
     Address next_address = address + instruction.length;
     visit(address);
     if (instruction.mnemonic == ZYDIS_MNEMONIC_CALL) {
@@ -120,10 +177,17 @@ bool Flo::is_conditional_jump(ZydisMnemonic mnemonic)
     }
 }
 
-ZydisDecodedInstruction const *Flo::get_instruction(Address address) const
+DecodedInstruction const *Flo::get_instruction(Address address) const
 {
-    if (auto it = disassembly_.find(address); it != disassembly_.end()) {
-        return it->second.get();
+    if (frozen_) {
+        if (auto it = disassembly_.find(address); it != disassembly_.end()) {
+            return it->second;
+        }
+        return nullptr;
+    }
+    if (auto it = discovered_disassembly_.find(address);
+        it != discovered_disassembly_.end()) {
+        return it->second;
     }
     return nullptr;
 }
@@ -144,7 +208,7 @@ std::vector<Cycle const *> Flo::get_cycles(Address address) const
 }
 
 Flo::SPManipulationType Flo::analyze_stack_pointer_manipulation(
-    ZydisDecodedInstruction const &instruction)
+    DecodedInstruction const &instruction)
 {
     if (stack_depth_is_ambiguous()) {
         return SPAmbiguous;
@@ -193,7 +257,7 @@ Address Flo::get_unanalized_inner_jump_dst() const
 {
     for (auto it = inner_jumps_.begin(), end = inner_jumps_.end(); it != end;
          it = inner_jumps_.upper_bound(it->first)) {
-        if (!disassembly_.contains(it->first)) {
+        if (!discovered_disassembly_.contains(it->first)) {
             return it->first;
         }
     }
@@ -217,16 +281,30 @@ void Flo::promote_unknown_jumps(Jump::Type type,
 
 void Flo::set_end(Address end)
 {
-    disassembly_.erase(disassembly_.lower_bound(end), disassembly_.end());
+    discovered_disassembly_.erase(discovered_disassembly_.lower_bound(end),
+                                  discovered_disassembly_.end());
     end_ = end;
 }
 
-bool Flo::modifies_flags_register(ZydisDecodedInstruction const &instruction)
+void Flo::freeze()
+{
+    assert(!frozen_);
+    disassembly_ = Disassembly(discovered_disassembly_);
+    discovered_disassembly_.clear();
+    inner_jump_dsts_.reserve(inner_jumps_.size());
+    for (auto it = inner_jumps_.begin(), end = inner_jumps_.end(); it != end;
+         it = inner_jumps_.upper_bound(it->first)) {
+        inner_jump_dsts_.push_back(it->first);
+    }
+    frozen_ = true;
+}
+
+bool Flo::modifies_flags_register(DecodedInstruction const &instruction)
 {
     return std::any_of(
         instruction.operands,
         instruction.operands + instruction.operand_count,
-        [](ZydisDecodedOperand const &op) {
+        [](DecodedOperand const &op) {
             if (op.type != ZYDIS_OPERAND_TYPE_REGISTER
                 || !(op.actions & ZYDIS_OPERAND_ACTION_MASK_WRITE)) {
                 return false;
@@ -244,6 +322,7 @@ bool Flo::modifies_flags_register(ZydisDecodedInstruction const &instruction)
 
 void Flo::add_cycle(Address first, Address last)
 {
+    assert(frozen_);
     assert(is_inside(first) && is_inside(last));
     Cycle::ExitConditions exit_conditions;
     auto it = disassembly_.find(last);
@@ -265,7 +344,7 @@ void Flo::add_cycle(Address first, Address last)
                     std::piecewise_construct,
                     std::forward_as_tuple(
                         virt::Registers::promote(op.reg.value)),
-                    std::forward_as_tuple(jt->second.get(),
+                    std::forward_as_tuple(jt->second,
                                           it->second->mnemonic));
             }
         }
@@ -304,7 +383,7 @@ void Flo::add_reference(Address reference)
 }
 
 void Flo::add_jump(Jump::Type type,
-                   ZydisDecodedInstruction const &ins,
+                   DecodedInstruction const &ins,
                    Address dst,
                    Address src)
 {
@@ -321,7 +400,7 @@ void Flo::add_jump(Jump::Type type,
     }
 }
 
-void Flo::add_call(ZydisDecodedInstruction const &ins,
+void Flo::add_call(DecodedInstruction const &ins,
                    Address dst,
                    Address src,
                    Address ret)
@@ -345,14 +424,35 @@ bool Flo::promote_unknown_jumps(Address dst, Jump::Type new_type)
     return promoted;
 }
 
+Instruction Flo::make_instruction(utils::Arena &arena,
+                                  [[maybe_unused]] Address address,
+                                  ZydisDecodedInstruction const &instr)
+{
+#ifdef RSTC_COMPACT_INSTRUCTIONS
+    return CompactInstruction::make(arena, instr, address);
+#else
+    return arena.make<ZydisDecodedInstruction>(instr);
+#endif
+}
+
+Instruction Flo::make_instruction(utils::Arena &arena,
+                                  DecodedInstruction const &instr)
+{
+#ifdef RSTC_COMPACT_INSTRUCTIONS
+    return CompactInstruction::copy(arena, instr);
+#else
+    return arena.make<ZydisDecodedInstruction>(instr);
+#endif
+}
+
 void Flo::visit(Address address)
 {
     promote_unknown_jumps(address, Jump::Inner);
 }
 
-bool Flo::should_be_unreachable(ZydisDecodedInstruction const &instruction)
+bool Flo::should_be_unreachable(ZydisMnemonic mnemonic)
 {
-    switch (instruction.mnemonic) {
+    switch (mnemonic) {
     case ZYDIS_MNEMONIC_INT3: return true;
     }
     return false;
@@ -383,12 +483,12 @@ Jump::Type Flo::get_jump_type(Address dst,
         return Jump::Outer;
     }
     // If jump is first flo instruction
-    if (disassembly_.size() == 1 && unconditional) {
+    if (discovered_disassembly_.size() == 1 && unconditional) {
         // Assume JMP table
         return Jump::Outer;
     }
     // If destination is one of the previous instructions
-    if (disassembly_.contains(dst)) {
+    if (discovered_disassembly_.contains(dst)) {
         return Jump::Inner;
     }
     // If jumping above entry-point
@@ -419,11 +519,18 @@ bool Flo::stack_depth_is_ambiguous() const
 
 bool Flo::is_inside(Address address) const
 {
-    return disassembly_.contains(address) || inner_jumps_.contains(address);
+    if (frozen_) {
+        return disassembly_.contains(address)
+               || std::binary_search(inner_jump_dsts_.begin(),
+                                     inner_jump_dsts_.end(),
+                                     address);
+    }
+    return discovered_disassembly_.contains(address)
+           || inner_jumps_.contains(address);
 }
 
 Address Flo::get_jump_destination(Address address,
-                                  ZydisDecodedInstruction const &instruction)
+                                  DecodedInstruction const &instruction)
 {
     assert(is_any_jump(instruction.mnemonic));
     assert(instruction.operand_count > 0);
@@ -438,7 +545,7 @@ Address Flo::get_jump_destination(Address address,
 
 std::unordered_set<Address>
 Flo::get_jump_destinations(Address address,
-                           ZydisDecodedInstruction const &instruction,
+                           DecodedInstruction const &instruction,
                            Contexts const &contexts)
 {
     assert(is_any_jump(instruction.mnemonic));
@@ -467,7 +574,7 @@ Flo::get_jump_destinations(Address address,
 }
 
 Address Flo::get_call_destination(Address address,
-                                  ZydisDecodedInstruction const &instruction)
+                                  DecodedInstruction const &instruction)
 {
     assert(instruction.mnemonic == ZYDIS_MNEMONIC_CALL);
     assert(instruction.operand_count > 0);
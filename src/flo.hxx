@@ -5,15 +5,21 @@
 #include "contexts.hxx"
 #include "pe.hxx"
 
+#include "utils/arena.hxx"
+
 #include <Zydis/Zydis.h>
 
+#include <cassert>
+#include <compare>
 #include <functional>
+#include <iterator>
 #include <map>
 #include <memory>
 #include <mutex>
 #include <optional>
 #include <set>
 #include <variant>
+#include <vector>
 
 namespace rstc {
 
@@ -24,7 +30,7 @@ namespace rstc {
             Outer,
         };
         Jump(Type type,
-             ZydisDecodedInstruction const &ins,
+             DecodedInstruction const &ins,
              Address dst,
              Address src)
             : ins(ins)
@@ -33,7 +39,7 @@ namespace rstc {
             , src(src)
         {
         }
-        ZydisDecodedInstruction const &ins;
+        DecodedInstruction const &ins;
         Type const type;
         Address const dst;
         Address const src;
@@ -43,7 +49,7 @@ namespace rstc {
     using Jumps = std::multimap<Address, Jump>;
 
     struct Call : public Jump {
-        Call(ZydisDecodedInstruction const &ins,
+        Call(DecodedInstruction const &ins,
              Address dst,
              Address src,
              Address ret)
@@ -59,13 +65,13 @@ namespace rstc {
 
     struct Cycle {
         struct ExitCondition {
-            ExitCondition(ZydisDecodedInstruction const *instruction,
+            ExitCondition(DecodedInstruction const *instruction,
                           ZydisMnemonic const jump)
                 : instruction(instruction)
                 , jump(jump)
             {
             }
-            ZydisDecodedInstruction const *const instruction;
+            DecodedInstruction const *const instruction;
             ZydisMnemonic const jump;
         };
         using ExitConditions = std::multimap<ZydisRegister, ExitCondition>;
@@ -84,7 +90,146 @@ namespace rstc {
     // Address of last instruction -> Cycle
     using Cycles = std::map<Address, Cycle>;
 
-    using Disassembly = std::map<Address, Instruction>;
+    // Disassembly of a flo under discovery
+    using DiscoveredDisassembly = std::map<Address, Instruction>;
+
+    // Read-only disassembly of a discovered flo.
+    // Sorted addresses with a parallel array of instructions,
+    // iterated like `std::map<Address, Instruction>`.
+    class Disassembly {
+    public:
+        using value_type = std::pair<Address, Instruction>;
+
+        class const_iterator {
+        public:
+            using iterator_category = std::random_access_iterator_tag;
+            using value_type = Disassembly::value_type;
+            using difference_type = std::ptrdiff_t;
+            using reference = value_type;
+
+            struct pointer {
+                value_type value;
+                inline value_type const *operator->() const { return &value; }
+            };
+
+            const_iterator() = default;
+            const_iterator(Address const *address,
+                           Instruction const *instruction)
+                : address_(address)
+                , instruction_(instruction)
+            {
+            }
+
+            inline reference operator*() const
+            {
+                return { *address_, *instruction_ };
+            }
+            inline pointer operator->() const { return { **this }; }
+            inline reference operator[](difference_type n) const
+            {
+                return *(*this + n);
+            }
+
+            inline const_iterator &operator++()
+            {
+                ++address_;
+                ++instruction_;
+                return *this;
+            }
+            inline const_iterator operator++(int)
+            {
+                auto it = *this;
+                ++*this;
+                return it;
+            }
+            inline const_iterator &operator--()
+            {
+                --address_;
+                --instruction_;
+                return *this;
+            }
+            inline const_iterator operator--(int)
+            {
+                auto it = *this;
+                --*this;
+                return it;
+            }
+            inline const_iterator &operator+=(difference_type n)
+            {
+                address_ += n;
+                instruction_ += n;
+                return *this;
+            }
+            inline const_iterator &operator-=(difference_type n)
+            {
+                return *this += -n;
+            }
+            inline const_iterator operator+(difference_type n) const
+            {
+                auto it = *this;
+                return it += n;
+            }
+            inline const_iterator operator-(difference_type n) const
+            {
+                auto it = *this;
+                return it -= n;
+            }
+            inline difference_type operator-(const_iterator const &other) const
+            {
+                return address_ - other.address_;
+            }
+
+            inline bool operator==(const_iterator const &other) const
+            {
+                return address_ == other.address_;
+            }
+            inline auto operator<=>(const_iterator const &other) const
+            {
+                return address_ <=> other.address_;
+            }
+
+        private:
+            Address const *address_ = nullptr;
+            Instruction const *instruction_ = nullptr;
+        };
+
+        using const_reverse_iterator = std::reverse_iterator<const_iterator>;
+
+        Disassembly() = default;
+        explicit Disassembly(DiscoveredDisassembly const &disassembly);
+
+        inline const_iterator begin() const
+        {
+            return { addresses_.data(), instructions_.data() };
+        }
+        inline const_iterator end() const
+        {
+            return begin() + addresses_.size();
+        }
+        inline const_reverse_iterator rbegin() const
+        {
+            return const_reverse_iterator(end());
+        }
+        inline const_reverse_iterator rend() const
+        {
+            return const_reverse_iterator(begin());
+        }
+
+        inline size_t size() const { return addresses_.size(); }
+        inline bool empty() const { return addresses_.empty(); }
+
+        const_iterator lower_bound(Address address) const;
+        const_iterator find(Address address) const;
+        inline bool contains(Address address) const
+        {
+            return find(address) != end();
+        }
+        Instruction at(Address address) const;
+
+    private:
+        std::vector<Address> addresses_;
+        std::vector<Instruction> instructions_;
+    };
 
     class Flo {
     public:
@@ -116,6 +261,10 @@ namespace rstc {
             Address reference = nullptr,
             std::optional<Address> end = std::nullopt);
 
+        AnalysisResult analyze(Address address,
+                               ZydisDecodedInstruction const &instr);
+        // Copies a decoded instruction, e.g. from the decode cache,
+        // into the flo's arena, `instr` only needs to outlive the call.
         AnalysisResult analyze(Address address, Instruction instr);
         Address get_unanalized_inner_jump_dst() const;
 
@@ -125,6 +274,12 @@ namespace rstc {
 
         void set_end(Address end);
 
+        // Moves the disassembly into contiguous sorted arrays.
+        // Must be called once the discovery is finished, after that
+        // the flo cannot be analyzed anymore.
+        void freeze();
+        inline bool is_frozen() const { return frozen_; }
+
         void add_cycle(Address first, Address last);
         void add_reference(Address reference);
 
@@ -132,19 +287,28 @@ namespace rstc {
 
         static Address
         get_jump_destination(Address address,
-                             ZydisDecodedInstruction const &instruction);
+                             DecodedInstruction const &instruction);
         std::unordered_set<Address>
         get_jump_destinations(Address address,
-                              ZydisDecodedInstruction const &instruction,
+                              DecodedInstruction const &instruction,
                               Contexts const &contexts);
         static Address
         get_call_destination(Address address,
-                             ZydisDecodedInstruction const &instruction);
+                             DecodedInstruction const &instruction);
+
+        // Copies the instruction into the arena as `DecodedInstruction`.
+        static Instruction
+        make_instruction(utils::Arena &arena,
+                         Address address,
+                         ZydisDecodedInstruction const &instr);
+        // Copies an instruction decoded into another arena
+        static Instruction make_instruction(utils::Arena &arena,
+                                            DecodedInstruction const &instr);
 
         static bool is_any_jump(ZydisMnemonic mnemonic);
         static bool is_conditional_jump(ZydisMnemonic mnemonic);
 
-        ZydisDecodedInstruction const *get_instruction(Address address) const;
+        DecodedInstruction const *get_instruction(Address address) const;
 
         inline PE const &get_pe() const { return pe_; }
 
@@ -155,8 +319,14 @@ namespace rstc {
 
         inline Disassembly const &get_disassembly() const
         {
+            assert(frozen_);
             return disassembly_;
         }
+        inline DiscoveredDisassembly const &get_discovered_disassembly() const
+        {
+            assert(!frozen_);
+            return discovered_disassembly_;
+        }
         inline Jumps const &get_inner_jumps() const { return inner_jumps_; }
         inline Jumps const &get_outer_jumps() const { return outer_jumps_; }
         inline Jumps const &get_unknown_jumps() const { return unknown_jumps_; }
@@ -171,27 +341,29 @@ namespace rstc {
         Address const entry_point;
 
     private:
-        bool should_be_unreachable(ZydisDecodedInstruction const &instruction);
+        static bool should_be_unreachable(ZydisMnemonic mnemonic);
+        AnalysisResult analyze_inserted(Address address,
+                                        DecodedInstruction const &instruction);
         Jump::Type get_jump_type(Address dst,
                                  Address src,
                                  Address next,
                                  bool unconditional) const;
 
         SPManipulationType analyze_stack_pointer_manipulation(
-            ZydisDecodedInstruction const &instruction);
+            DecodedInstruction const &instruction);
         void visit(Address address);
         bool promote_unknown_jumps(Address dst, Jump::Type new_type);
 
         static bool
-        modifies_flags_register(ZydisDecodedInstruction const &instruction);
+        modifies_flags_register(DecodedInstruction const &instruction);
 
         bool stack_depth_is_ambiguous() const;
 
         void add_jump(Jump::Type type,
-                      ZydisDecodedInstruction const &ins,
+                      DecodedInstruction const &ins,
                       Address dst,
                       Address src);
-        void add_call(ZydisDecodedInstruction const &ins,
+        void add_call(DecodedInstruction const &ins,
                       Address dst,
                       Address src,
                       Address ret);
@@ -199,7 +371,12 @@ namespace rstc {
         std::optional<Address> end_;
         std::mutex modify_access_mutex_;
         PE const &pe_;
+        utils::Arena instructions_arena_;
+        DiscoveredDisassembly discovered_disassembly_;
         Disassembly disassembly_;
+        // Sorted unique destinations of inner jumps, filled by `freeze`
+        std::vector<Address> inner_jump_dsts_;
+        bool frozen_ = false;
         std::set<Address> references_;
         Jumps inner_jumps_;
         Jumps outer_jumps_;
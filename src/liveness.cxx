@@ -0,0 +1,173 @@
+#include "liveness.hxx"
+
+#include <array>
+#include <iterator>
+
+using namespace rstc;
+
+using Reg = virt::Registers::Reg;
+
+Liveness::Registers const Liveness::all_registers_ =
+    (Registers(1) << virt::Registers::REGISTERS_COUNT) - 1;
+
+// Result and nonvolatile registers of the x64 calling convention
+Liveness::Registers const Liveness::returned_registers_ =
+    mask(Reg::RAX) | mask(Reg::RBX) | mask(Reg::RBP) | mask(Reg::RSP)
+    | mask(Reg::RDI) | mask(Reg::RSI) | mask(Reg::R12) | mask(Reg::R13)
+    | mask(Reg::R14) | mask(Reg::R15) | mask(Reg::ZMM0) | mask(Reg::ZMM6)
+    | mask(Reg::ZMM7) | mask(Reg::ZMM8) | mask(Reg::ZMM9) | mask(Reg::ZMM10)
+    | mask(Reg::ZMM11) | mask(Reg::ZMM12) | mask(Reg::ZMM13)
+    | mask(Reg::ZMM14) | mask(Reg::ZMM15);
+
+// Reset by the emulation of calls, see `Recontex::volatile_registers_`
+Liveness::Registers const Liveness::volatile_registers_ =
+    mask(Reg::RAX) | mask(Reg::RCX) | mask(Reg::RDX) | mask(Reg::R8)
+    | mask(Reg::R9) | mask(Reg::R10) | mask(Reg::R11) | mask(Reg::ZMM0)
+    | mask(Reg::ZMM1) | mask(Reg::ZMM2) | mask(Reg::ZMM3) | mask(Reg::ZMM4)
+    | mask(Reg::ZMM5);
+
+Liveness::Liveness(Flo const &flo)
+    : disassembly_(flo.get_disassembly())
+    , newly_dead_(disassembly_.size(), 0)
+{
+    static constexpr size_t none = -1;
+    size_t count = disassembly_.size();
+    std::vector<Effect> effects(count);
+    // Up to two successors inside the flo
+    std::vector<std::array<size_t, 2>> successors(count, { none, none });
+    // Registers read after leaving the flo
+    std::vector<Registers> escaping(count, 0);
+    auto index_of = [this](Address address) -> size_t {
+        if (auto it = disassembly_.find(address); it != disassembly_.end()) {
+            return std::distance(disassembly_.begin(), it);
+        }
+        return none;
+    };
+    for (size_t i = 0; i < count; i++) {
+        auto [address, instruction] = *(disassembly_.begin() + i);
+        effects[i] = get_effect(*instruction);
+        auto mnemonic = instruction->mnemonic;
+        if (mnemonic == ZYDIS_MNEMONIC_RET) {
+            escaping[i] = returned_registers_;
+            continue;
+        }
+        if (Flo::is_any_jump(mnemonic)) {
+            auto dst = Flo::get_jump_destination(address, *instruction);
+            if (size_t j = dst ? index_of(dst) : none; j != none) {
+                successors[i][0] = j;
+            }
+            else {
+                escaping[i] = all_registers_;
+            }
+            if (mnemonic == ZYDIS_MNEMONIC_JMP) {
+                continue;
+            }
+        }
+        if (size_t j = index_of(address + instruction->length); j != none) {
+            successors[i][1] = j;
+        }
+        else {
+            escaping[i] = all_registers_;
+        }
+    }
+
+    // Liveness only grows, so iterating backwards until nothing changes
+    // converges in a few passes even with loops
+    std::vector<Registers> live_in(count, 0);
+    std::vector<Registers> live_out(count, 0);
+    for (bool changed = true; changed;) {
+        changed = false;
+        for (size_t i = count; i-- > 0;) {
+            Registers out = escaping[i];
+            for (auto j : successors[i]) {
+                if (j != none) {
+                    out |= live_in[j];
+                }
+            }
+            Registers in = effects[i].used | (out & ~effects[i].killed);
+            if (in != live_in[i] || out != live_out[i]) {
+                live_in[i] = in;
+                live_out[i] = out;
+                changed = true;
+            }
+        }
+    }
+
+    // Registers which are dead, and therefore canonical,
+    // after every known predecessor
+    std::vector<Registers> canonical_in(count, all_registers_);
+    std::vector<bool> has_predecessors(count, false);
+    for (size_t i = 0; i < count; i++) {
+        for (auto j : successors[i]) {
+            if (j != none) {
+                canonical_in[j] &= ~live_out[i];
+                has_predecessors[j] = true;
+            }
+        }
+    }
+    // Contexts enter the flo and targets of unknown jumps as they are
+    if (size_t entry = index_of(flo.entry_point); entry != none) {
+        has_predecessors[entry] = false;
+    }
+    for (auto const &[dst, jump] : flo.get_unknown_jumps()) {
+        if (size_t j = index_of(dst); j != none) {
+            has_predecessors[j] = false;
+        }
+    }
+    for (size_t i = 0; i < count; i++) {
+        Registers canonical = has_predecessors[i] ? canonical_in[i] : 0;
+        Registers dead = ~live_out[i] & all_registers_;
+        newly_dead_[i] = dead & ~(canonical & ~effects[i].written);
+    }
+}
+
+Liveness::Registers Liveness::get_newly_dead(Address address) const
+{
+    if (auto it = disassembly_.find(address); it != disassembly_.end()) {
+        return newly_dead_[std::distance(disassembly_.begin(), it)];
+    }
+    return 0;
+}
+
+Liveness::Effect Liveness::get_effect(DecodedInstruction const &instruction)
+{
+    Effect effect;
+    if (instruction.mnemonic == ZYDIS_MNEMONIC_CALL) {
+        // Arguments might be passed in any register,
+        // volatile ones are reset by the emulation
+        effect.used = all_registers_;
+        effect.written = volatile_registers_;
+    }
+    for (size_t i = 0; i < instruction.operand_count; i++) {
+        auto const &op = instruction.operands[i];
+        switch (op.type) {
+        case ZYDIS_OPERAND_TYPE_REGISTER: {
+            auto reg = virt::Registers::from_zydis(op.reg.value);
+            if (!reg) {
+                break;
+            }
+            if (op.actions & ZYDIS_OPERAND_ACTION_MASK_READ) {
+                effect.used |= mask(*reg);
+            }
+            if (op.actions & ZYDIS_OPERAND_ACTION_MASK_WRITE) {
+                effect.written |= mask(*reg);
+                // 8 and 16 bits writes keep the rest of the register
+                if (!(op.actions & ZYDIS_OPERAND_ACTION_CONDWRITE)
+                    && op.size >= 32) {
+                    effect.killed |= mask(*reg);
+                }
+            }
+            break;
+        }
+        case ZYDIS_OPERAND_TYPE_MEMORY:
+            for (auto zydis_reg : { op.mem.base, op.mem.index }) {
+                if (auto reg = virt::Registers::from_zydis(zydis_reg); reg) {
+                    effect.used |= mask(*reg);
+                }
+            }
+            break;
+        default: break;
+        }
+    }
+    return effect;
+}
@@ -0,0 +1,58 @@
+#pragma once
+
+#include "core.hxx"
+
+#include "flo.hxx"
+#include "virtual/registers.hxx"
+
+#include <cstdint>
+#include <vector>
+
+namespace rstc {
+
+    // Backward liveness of registers over the disassembly of a frozen flo.
+    // A register is dead after an instruction if every way from there
+    // overwrites it before reading it. Calls and jumps out of the flo read
+    // every register, returns read the result and nonvolatile registers.
+    class Liveness {
+    public:
+        // Bit per `virt::Registers::Reg`
+        using Registers = uint64_t;
+
+        static_assert(virt::Registers::REGISTERS_COUNT
+                      <= sizeof(Registers) * 8);
+
+        explicit Liveness(Flo const &flo);
+
+        // Registers which are dead after the instruction, but aren't
+        // known to be dead on every way into it, or are written by it.
+        // Canonicalizing them after each instruction keeps all of the
+        // dead registers canonical.
+        Registers get_newly_dead(Address address) const;
+
+        static constexpr Registers mask(virt::Registers::Reg reg)
+        {
+            return Registers(1) << reg;
+        }
+
+    private:
+        struct Effect {
+            // Registers read by the instruction
+            Registers used = 0;
+            // Registers whose whole value is overwritten
+            Registers killed = 0;
+            // Registers which might be written at all
+            Registers written = 0;
+        };
+
+        static Effect get_effect(DecodedInstruction const &instruction);
+
+        static Registers const all_registers_;
+        static Registers const returned_registers_;
+        static Registers const volatile_registers_;
+
+        Disassembly const &disassembly_;
+        std::vector<Registers> newly_dead_;
+    };
+
+}
@@ -5,6 +5,7 @@
 #include <chrono>
 #include <iomanip>
 #include <iostream>
+#include <string_view>
 
 std::chrono::milliseconds measure(std::function<void(void)> fx)
 {
@@ -16,8 +17,42 @@ std::chrono::milliseconds measure(std::function<void(void)> fx)
 
 int wmain(int argc, wchar_t *argv[])
 {
-    if (argc != 2) {
-        std::cerr << "restruc.exe <filename>\n";
+    bool seeded = false;
+    bool predecode = false;
+    bool pipeline = false;
+    auto engine = rstc::Recontex::Engine::Automatic;
+    bool record_all = false;
+    wchar_t const *filename = nullptr;
+    for (int i = 1; i < argc; i++) {
+        if (std::wstring_view(argv[i]) == L"--seeded") {
+            seeded = true;
+        }
+        else if (std::wstring_view(argv[i]) == L"--predecode") {
+            predecode = true;
+        }
+        else if (std::wstring_view(argv[i]) == L"--pipeline") {
+            pipeline = true;
+        }
+        else if (std::wstring_view(argv[i]) == L"--paths") {
+            engine = rstc::Recontex::Engine::Paths;
+        }
+        else if (std::wstring_view(argv[i]) == L"--dataflow") {
+            engine = rstc::Recontex::Engine::Dataflow;
+        }
+        else if (std::wstring_view(argv[i]) == L"--record-all") {
+            record_all = true;
+        }
+        else if (!filename) {
+            filename = argv[i];
+        }
+        else {
+            filename = nullptr;
+            break;
+        }
+    }
+    if (!filename) {
+        std::cerr << "restruc.exe [--seeded] [--predecode] [--pipeline] "
+                     "[--paths | --dataflow] [--record-all] <filename>\n";
         return EXIT_FAILURE;
     }
 
@@ -25,7 +60,7 @@ int wmain(int argc, wchar_t *argv[])
     try
 #endif
     {
-        rstc::Reflo reflo(argv[1]);
+        rstc::Reflo reflo(filename);
         rstc::Recontex recontex(reflo);
         rstc::Restruc restruc(reflo, recontex);
 
@@ -35,6 +70,22 @@ int wmain(int argc, wchar_t *argv[])
         restruc.set_max_analyzing_threads(1);
 #endif
 
+        if (seeded) {
+            reflo.set_discovery(rstc::Reflo::Discovery::Seeded);
+        }
+        reflo.set_predecode(predecode);
+        recontex.set_engine(engine);
+        if (record_all) {
+            recontex.set_recording(rstc::Recontex::Recording::All);
+        }
+        if (pipeline) {
+            // Only inter-linking of strucs waits for all flos
+            reflo.set_publish_callback([&recontex, &restruc](rstc::Flo &flo) {
+                recontex.analyze(flo);
+                restruc.analyze(flo);
+            });
+        }
+
         std::chrono::milliseconds time;
 
         std::cout << "// Reflo::analyze ...\n";
@@ -45,14 +96,37 @@ int wmain(int argc, wchar_t *argv[])
                   << std::setw(8) << analyzed.second << "], " << std::dec
                   << reflo.get_flos().size() << " functions in " << std::dec
                   << time.count() << "ms\n";
-        std::cout << "// Recontex::analyze ...\n";
-        time = measure([&recontex] { recontex.analyze(); });
-        std::cout << "// Analyzed " << std::dec << reflo.get_flos().size()
-                  << " functions in " << std::dec << time.count() << "ms\n";
-        std::cout << "// Restruc::analyze ...\n";
-        time = measure([&restruc] { restruc.analyze(); });
-        std::cout << "// Analyzed " << std::dec << reflo.get_flos().size()
-                  << " functions in " << std::dec << time.count() << "ms\n";
+        auto const &stats = reflo.get_discovery_stats();
+        std::cout << "// Entry point: " << std::dec << stats.entry_point
+                  << ", runtime functions: " << stats.runtime_functions
+                  << ", exports: " << stats.exports
+                  << ", TLS callbacks: " << stats.tls_callbacks
+                  << ", discovered: " << stats.discovered << '\n';
+        if (pipeline) {
+            std::cout << "// Restruc::link ...\n";
+            time = measure([&restruc] { restruc.link(); });
+            std::cout << "// Linked " << std::dec << reflo.get_flos().size()
+                      << " functions in " << std::dec << time.count()
+                      << "ms\n";
+        }
+        else {
+            std::cout << "// Recontex::analyze ...\n";
+            time = measure([&recontex] { recontex.analyze(); });
+            std::cout << "// Analyzed " << std::dec << reflo.get_flos().size()
+                      << " functions in " << std::dec << time.count()
+                      << "ms\n";
+            std::cout << "// Restruc::analyze ...\n";
+            time = measure([&restruc] { restruc.analyze(); });
+            std::cout << "// Analyzed " << std::dec << reflo.get_flos().size()
+                      << " functions in " << std::dec << time.count()
+                      << "ms\n";
+        }
+        auto const &memo_stats = recontex.get_block_memo_stats();
+        if (auto blocks = memo_stats.hits + memo_stats.misses; blocks) {
+            std::cout << "// Block memo: " << std::dec << memo_stats.hits
+                      << " hits, " << memo_stats.misses << " misses, "
+                      << memo_stats.hits * 100 / blocks << "% hit rate\n";
+        }
         std::cout << "// Recovered " << std::dec << restruc.get_strucs().size()
                   << " structures\n";
         std::cout << '\n';
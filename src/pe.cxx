@@ -1,11 +1,12 @@
 #include "pe.hxx"
 
+#include <algorithm>
 #include <fstream>
 
 using namespace rstc;
 
 PE::PE(std::filesystem::path const &path)
-    : bytes_(Bytes(path))
+    : bytes_(path)
 {
     auto file_header = image_file_header();
     if (file_header->Machine != IMAGE_FILE_MACHINE_AMD64) {
@@ -30,6 +31,22 @@ PE::PE(std::filesystem::path const &path)
               [](IMAGE_SECTION_HEADER const *a, IMAGE_SECTION_HEADER const *b) {
                   return a->PointerToRawData < b->PointerToRawData;
               });
+    std::vector<DWORD> starts(sections_by_va_.size());
+    std::transform(sections_by_va_.begin(),
+                   sections_by_va_.end(),
+                   starts.begin(),
+                   [](IMAGE_SECTION_HEADER const *section) {
+                       return section->VirtualAddress;
+                   });
+    va_table_.build(std::move(starts));
+    starts.resize(sections_by_raw_data_.size());
+    std::transform(sections_by_raw_data_.begin(),
+                   sections_by_raw_data_.end(),
+                   starts.begin(),
+                   [](IMAGE_SECTION_HEADER const *section) {
+                       return section->PointerToRawData;
+                   });
+    raw_data_table_.build(std::move(starts));
     for (auto const &runtime_function : runtime_functions()) {
         runtime_function_map_.emplace(runtime_function.BeginAddress,
                                       &runtime_function);
@@ -60,17 +77,11 @@ IMAGE_SECTION_HEADER const *PE::image_first_section() const
 IMAGE_SECTION_HEADER const *
 PE::get_section_by_raw_address(Byte const *pointer) const
 {
-    auto it = std::upper_bound(
-        sections_by_raw_data_.begin(),
-        sections_by_raw_data_.end(),
-        static_cast<DWORD>(pointer - data()),
-        [](DWORD raw_address, IMAGE_SECTION_HEADER const *section) {
-            return raw_address < section->PointerToRawData;
-        });
-    if (it == sections_by_raw_data_.begin()) {
+    auto index = raw_data_table_.find(static_cast<DWORD>(pointer - data()));
+    if (index == PageTable::npos) {
         throw std::runtime_error("invalid raw address");
     }
-    return *std::prev(it);
+    return sections_by_raw_data_[index];
 }
 
 IMAGE_FILE_HEADER const *PE::image_file_header() const
@@ -117,19 +128,93 @@ RUNTIME_FUNCTION const *PE::get_runtime_function(DWORD va) const
     return nullptr;
 }
 
+std::vector<DWORD> PE::exported_functions() const
+{
+    IMAGE_DATA_DIRECTORY const &directory_export =
+        image_optional_header64()->DataDirectory[IMAGE_DIRECTORY_ENTRY_EXPORT];
+    if (!directory_export.Size) {
+        return {};
+    }
+    Byte const *end = data() + bytes_.size();
+    auto export_directory = reinterpret_cast<IMAGE_EXPORT_DIRECTORY const *>(
+        virtual_to_raw_address(directory_export.VirtualAddress));
+    if (!export_directory
+        || reinterpret_cast<Byte const *>(export_directory + 1) > end) {
+        return {};
+    }
+    auto functions = reinterpret_cast<DWORD const *>(
+        virtual_to_raw_address(export_directory->AddressOfFunctions));
+    if (!functions || reinterpret_cast<Byte const *>(functions) > end) {
+        return {};
+    }
+    // Functions past the end of the image are ignored
+    size_t count = std::min<size_t>(
+        export_directory->NumberOfFunctions,
+        (end - reinterpret_cast<Byte const *>(functions)) / sizeof(DWORD));
+    std::vector<DWORD> exports;
+    exports.reserve(count);
+    for (size_t i = 0; i < count; i++) {
+        DWORD va = functions[i];
+        // Unused ordinal
+        if (!va) {
+            continue;
+        }
+        // Forwarder, points to a string inside the export directory
+        if (va >= directory_export.VirtualAddress
+            && va < directory_export.VirtualAddress + directory_export.Size) {
+            continue;
+        }
+        exports.push_back(va);
+    }
+    return exports;
+}
+
+std::vector<DWORD> PE::tls_callbacks() const
+{
+    IMAGE_DATA_DIRECTORY const &directory_tls =
+        image_optional_header64()->DataDirectory[IMAGE_DIRECTORY_ENTRY_TLS];
+    if (!directory_tls.Size) {
+        return {};
+    }
+    auto tls_directory = reinterpret_cast<IMAGE_TLS_DIRECTORY64 const *>(
+        virtual_to_raw_address(directory_tls.VirtualAddress));
+    if (!tls_directory || !tls_directory->AddressOfCallBacks) {
+        return {};
+    }
+    // TLS directory holds absolute addresses
+    ULONGLONG image_base = image_optional_header64()->ImageBase;
+    auto callbacks = reinterpret_cast<ULONGLONG const *>(virtual_to_raw_address(
+        static_cast<DWORD>(tls_directory->AddressOfCallBacks - image_base)));
+    if (!callbacks) {
+        return {};
+    }
+    std::vector<DWORD> tls_callbacks;
+    Byte const *end = data() + bytes_.size();
+    for (; reinterpret_cast<Byte const *>(callbacks + 1) <= end && *callbacks;
+         callbacks++) {
+        tls_callbacks.push_back(static_cast<DWORD>(*callbacks - image_base));
+    }
+    return tls_callbacks;
+}
+
+bool PE::is_executable(DWORD va) const
+{
+    auto index = va_table_.find(va);
+    if (index == PageTable::npos) {
+        return false;
+    }
+    auto section = sections_by_va_[index];
+    return va < section->VirtualAddress + section->Misc.VirtualSize
+           && (section->Characteristics & IMAGE_SCN_MEM_EXECUTE);
+}
+
 Byte const *PE::virtual_to_raw_address(DWORD va) const
 {
-    auto it =
-        std::upper_bound(sections_by_va_.begin(),
-                         sections_by_va_.end(),
-                         va,
-                         [](DWORD va, IMAGE_SECTION_HEADER const *section) {
-                             return va < section->VirtualAddress;
-                         });
-    if (it == sections_by_va_.begin()) {
+    auto index = va_table_.find(va);
+    if (index == PageTable::npos) {
         return nullptr;
     }
-    auto section = *std::prev(it);
+    auto section = sections_by_va_[index];
     return data() + section->PointerToRawData + va - section->VirtualAddress;
 }
 
@@ -157,3 +242,38 @@ Byte const *PE::get_end(Byte const *pointer) const
     auto section = get_section_by_raw_address(pointer);
     return data() + section->PointerToRawData + section->SizeOfRawData;
 }
+
+void PE::PageTable::build(std::vector<DWORD> starts)
+{
+    starts_ = std::move(starts);
+    pages_.clear();
+    if (starts_.empty()) {
+        return;
+    }
+    // Pages past the last section start all resolve to the last section,
+    // so the table only needs to cover up to that page.
+    size_t pages_count = (size_t(starts_.back()) >> page_shift) + 1;
+    pages_.resize(pages_count);
+    auto it = starts_.begin();
+    for (size_t page = 0; page < pages_count; page++) {
+        auto page_start = static_cast<DWORD>(page << page_shift);
+        it = std::upper_bound(it, starts_.end(), page_start);
+        pages_[page] = it == starts_.begin()
+                           ? npos
+                           : std::distance(starts_.begin(), it) - 1;
+    }
+}
+
+size_t PE::PageTable::find(DWORD address) const
+{
+    if (pages_.empty()) {
+        return npos;
+    }
+    size_t page = std::min<size_t>(address >> page_shift, pages_.size() - 1);
+    size_t index = pages_[page];
+    size_t next = index == npos ? 0 : index + 1;
+    while (next < starts_.size() && starts_[next] <= address) {
+        index = next++;
+    }
+    return index;
+}
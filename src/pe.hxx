@@ -43,6 +43,11 @@ namespace rstc {
         Sections image_sections() const;
         RuntimeFunctions runtime_functions() const;
         RUNTIME_FUNCTION const *get_runtime_function(DWORD va) const;
+        // Virtual addresses of exported functions, forwarders are skipped.
+        std::vector<DWORD> exported_functions() const;
+        // Virtual addresses of TLS callbacks.
+        std::vector<DWORD> tls_callbacks() const;
+        bool is_executable(DWORD va) const;
 
         Byte const *virtual_to_raw_address(DWORD va) const;
         DWORD raw_to_virtual_address(Byte const *pointer) const;
@@ -53,6 +58,24 @@ namespace rstc {
         Byte const *get_end(Byte const *pointer) const;
 
     private:
+        // Maps an address to the index of the last section starting at or
+        // before it, the same as `upper_bound - 1` over the sorted starts.
+        // Each 4 KiB page stores the answer for its first byte, so a lookup
+        // is an indexed load plus a rare step over sections starting
+        // inside the page (raw data is only 512-byte aligned).
+        class PageTable {
+        public:
+            static size_t const page_shift = 12;
+            static size_t const npos = size_t(-1);
+
+            void build(std::vector<DWORD> starts);
+            size_t find(DWORD address) const;
+
+        private:
+            std::vector<DWORD> starts_;
+            std::vector<size_t> pages_;
+        };
+
         IMAGE_NT_HEADERS const *image_nt_headers() const;
         IMAGE_SECTION_HEADER const *image_first_section() const;
         IMAGE_SECTION_HEADER const *
@@ -61,6 +84,8 @@ namespace rstc {
         Bytes bytes_;
         std::vector<IMAGE_SECTION_HEADER const *> sections_by_va_;
         std::vector<IMAGE_SECTION_HEADER const *> sections_by_raw_data_;
+        PageTable va_table_;
+        PageTable raw_data_table_;
 
         std::unordered_map<DWORD, RUNTIME_FUNCTION const *>
             runtime_function_map_;
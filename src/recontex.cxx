@@ -1,11 +1,11 @@
 #include "recontex.hxx"
 
 #include "dumper.hxx"
-#include "scope_guard.hxx"
 #include "utils/adapters.hxx"
 #include "utils/hash.hxx"
 
 #include <algorithm>
+#include <bit>
 #include <iostream>
 #include <iterator>
 #include <map>
@@ -35,22 +35,80 @@ ZydisRegister const Recontex::nonvolatile_registers_[] = {
     ZYDIS_REGISTER_ZMM15,
 };
 
-std::unordered_map<ZydisMnemonic, Recontex::EmulationCallbackAction>
-    Recontex::emulation_callback_actions_{
-        { ZYDIS_MNEMONIC_ADD,
-          [](uintptr_t dst, uintptr_t src) { return dst + src; } },
-        { ZYDIS_MNEMONIC_SUB,
-          [](uintptr_t dst, uintptr_t src) { return dst - src; } },
-        { ZYDIS_MNEMONIC_OR,
-          [](uintptr_t dst, uintptr_t src) { return dst | src; } },
-        { ZYDIS_MNEMONIC_AND,
-          [](uintptr_t dst, uintptr_t src) { return dst & src; } },
-        { ZYDIS_MNEMONIC_XOR,
-          [](uintptr_t dst, uintptr_t src) { return dst ^ src; } },
-        { ZYDIS_MNEMONIC_IMUL,
-          [](uintptr_t dst, uintptr_t src) { return dst * src; } },
+namespace {
+
+    // Operations of binary instructions, inlined into their handlers
+
+    struct MovOperation {
+        static virt::Value combine(virt::Value const &dst,
+                                   virt::Value const &src)
+        {
+            uintptr_t mask = ~0;
+            if (dst.size() < 8) {
+                mask = (1ULL << (dst.size() * 8)) - 1;
+            }
+            if (!dst.is_symbolic() && !src.is_symbolic() && dst.size() < 4) {
+                return virt::make_value(src.source(),
+                                        (dst.value() & ~mask)
+                                            | (src.value() & mask),
+                                        dst.size());
+            }
+            else if (!src.is_symbolic()) {
+                return virt::make_value(src.source(),
+                                        src.value() & mask,
+                                        dst.size());
+            }
+            else {
+                return src;
+            }
+        }
     };
 
+    template<typename Action>
+    struct ArithmeticOperation {
+        static virt::Value combine(virt::Value const &dst,
+                                   virt::Value const &src)
+        {
+            Action action;
+            if (!dst.is_symbolic() && !src.is_symbolic()) {
+                uintptr_t mask = ~0;
+                if (dst.size() < 8) {
+                    mask = (1ULL << (dst.size() * 8)) - 1;
+                }
+                if (dst.size() < 4) {
+                    return virt::make_value(
+                        src.source(),
+                        (dst.value() & ~mask)
+                            | (action(dst.value(), src.value()) & mask),
+                        dst.size());
+                }
+                else {
+                    return virt::make_value(
+                        src.source(),
+                        action(dst.value(), src.value()) & mask,
+                        dst.size());
+                }
+            }
+            else if (dst.is_symbolic() && !src.is_symbolic()) {
+                return virt::make_symbolic_value(
+                    src.source(),
+                    dst.size(),
+                    action(dst.symbol().offset(), src.value()),
+                    dst.symbol().id());
+            }
+            return virt::make_symbolic_value(src.source(), dst.size());
+        }
+    };
+
+    using AddOperation = ArithmeticOperation<std::plus<uintptr_t>>;
+    using SubOperation = ArithmeticOperation<std::minus<uintptr_t>>;
+    using OrOperation = ArithmeticOperation<std::bit_or<uintptr_t>>;
+    using AndOperation = ArithmeticOperation<std::bit_and<uintptr_t>>;
+    using XorOperation = ArithmeticOperation<std::bit_xor<uintptr_t>>;
+    using ImulOperation = ArithmeticOperation<std::multiplies<uintptr_t>>;
+
+}
+
 #ifdef DEBUG_CONTEXT_PROPAGATION
 
 void dump_register_value(std::ostream &os,
@@ -79,223 +137,347 @@ void dump_register_value(std::ostream &os,
 Recontex::Recontex(Reflo &reflo)
     : reflo_(reflo)
     , pe_(reflo.get_pe())
-    , max_analyzing_threads_(std::thread::hardware_concurrency())
+    , executor_(reflo.get_executor())
 {
+    virt::Value::set_source_base(pe_.data());
 }
 
 void Recontex::analyze()
 {
     for (auto const &[address, flo] : reflo_.get_flos()) {
-        run_analysis(*flo);
+        executor_->submit([this, &flo = *flo] { run_analysis(flo, true); });
     }
 #ifdef DEBUG_ANALYSIS_PROGRESS
     std::clog << "Waiting for analysis to finish ...\n";
 #endif
-    wait_for_analysis();
+    executor_->wait();
 #ifdef DEBUG_ANALYSIS_PROGRESS
     std::clog << "Done.\n";
 #endif
 }
 
+void Recontex::analyze(Flo &flo)
+{
+    // The caller reads the contexts right away
+    run_analysis(flo, false);
+}
+
 void Recontex::set_max_analyzing_threads(size_t amount)
 {
-    max_analyzing_threads_ = amount;
+    executor_->set_workers_count(amount);
 }
 
 Recontex::FloContexts const &Recontex::get_contexts(Flo const &flo) const
 {
+    // Contexts of other flos might be added meanwhile,
+    // references to existing ones stay valid.
+    std::scoped_lock<std::mutex> get_contexts_guard(
+        modify_access_contexts_mutex_);
     return contexts_.at(flo.entry_point);
 }
 
-std::vector<Context const *> Recontex::get_contexts(Flo const &flo,
-                                                    Address address) const
+std::span<Context const> Recontex::get_contexts(Flo const &flo,
+                                                Address address) const
 {
-    std::vector<Context const *> contexts;
-    auto const &flo_contexts = contexts_.at(flo.entry_point);
-    auto range = utils::in_range(flo_contexts.equal_range(address));
-    contexts.reserve(std::distance(range.begin(), range.end()));
-    for (auto const &[addr, ctx] : range) {
-        contexts.push_back(&ctx);
-    }
-    return contexts;
+    return get_contexts(flo).get(address);
 }
 
-void Recontex::run_analysis(Flo &flo)
+void Recontex::run_analysis(Flo &flo, bool spawn)
 {
-    auto lock = std::unique_lock(analyzing_threads_mutex_);
-    analyzing_threads_cv_.wait(lock, [this] {
-        return analyzing_threads_count_ < max_analyzing_threads_;
-    });
-    ++analyzing_threads_count_;
-    analyzing_threads_.emplace_back([this, &flo]() mutable {
-        ScopeGuard decrement_analyzing_threads_count([this]() noexcept {
-            std::scoped_lock<std::mutex> notify_guard(analyzing_threads_mutex_);
-            --analyzing_threads_count_;
-            analyzing_threads_cv_.notify_all();
-        });
 #ifdef DEBUG_ANALYSIS_PROGRESS
-        std::clog << "Analyzing: " << std::dec << analyzing_threads_.size()
-                  << '/' << std::dec << reflo_.get_flos().size() << ": "
-                  << std::setfill('0') << std::setw(8) << std::hex
-                  << pe_.raw_to_virtual_address(flo.entry_point) << '\n';
+    std::clog << "Analyzing: " << std::setfill('0') << std::setw(8)
+              << std::hex << pe_.raw_to_virtual_address(flo.entry_point)
+              << '\n';
 #endif
-        FloContexts flo_contexts;
-        OptimalCoverage opt_cov(flo);
-        if (!opt_cov.analyze()) {
+    auto analysis = std::make_shared<FloAnalysis>(flo);
+    analysis->spawn = spawn;
+    auto &opt_cov = analysis->opt_cov;
+    if (!opt_cov.analyze()) {
 #ifdef DEBUG_OPTIMAL_COVERAGE
-            std::clog << "Optimal Coverage for " << std::hex
-                      << std::setfill('0') << std::right << std::setw(8)
-                      << pe_.raw_to_virtual_address(flo.entry_point)
-                      << " cannot be calculated.\n";
+        std::clog << "Optimal Coverage for " << std::hex
+                  << std::setfill('0') << std::right << std::setw(8)
+                  << pe_.raw_to_virtual_address(flo.entry_point)
+                  << " cannot be calculated.\n";
 #endif
-            return;
-        }
+        return;
+    }
+    bool use_paths = engine_ == Engine::Paths
+                     || (engine_ == Engine::Automatic
+                         && opt_cov.estimate_paths_count(max_paths_count_ + 1)
+                                <= max_paths_count_);
+    if (use_paths) {
+        opt_cov.build_paths();
+    }
+    find_recorded_instructions(flo, opt_cov, analysis->flo_contexts);
+    if (recording_ == Recording::Demanded) {
+        analysis->liveness.emplace(flo);
+        analysis->flo_contexts.liveness = &*analysis->liveness;
+    }
 #ifdef DEBUG_OPTIMAL_COVERAGE
-        auto get_va = [&pe_ = pe_](Address a) -> DWORD {
-            return a ? pe_.raw_to_virtual_address(a) : 0;
-        };
-        std::clog << "Optimal Coverage @ " << std::hex << std::setfill('0')
-                  << std::right << std::setw(8) << get_va(flo.entry_point)
-                  << '\n';
-        std::clog << "Nodes:\n";
-        for (auto const &[_, node] : opt_cov.nodes()) {
-            std::clog << std::hex << get_va(node.source) << " -> ";
-            for (auto branch : node.branches) {
-                std::clog << std::hex << get_va(branch.branch) << ' ';
-            }
-            std::clog << '\n';
+    auto get_va = [&pe_ = pe_](Address a) -> DWORD {
+        return a ? pe_.raw_to_virtual_address(a) : 0;
+    };
+    std::clog << "Optimal Coverage @ " << std::hex << std::setfill('0')
+              << std::right << std::setw(8) << get_va(flo.entry_point)
+              << '\n';
+    std::clog << "Nodes:\n";
+    for (auto const &[_, node] : opt_cov.nodes()) {
+        std::clog << std::hex << get_va(node.source) << " -> ";
+        for (auto branch : node.branches) {
+            std::clog << std::hex << get_va(branch.branch) << ' ';
         }
-        std::clog << "\nNodes order:\n";
-        std::vector<Address> nodes_order(opt_cov.nodes_order().size());
-        for (auto [node, index] : opt_cov.nodes_order()) {
-            nodes_order[index] = node;
-        }
-        for (auto node : nodes_order) {
-            std::clog << std::hex << get_va(node) << '\n';
-        }
-        std::clog << "\nLoops:\n";
-        for (auto const &loop : opt_cov.loops()) {
-            std::clog << std::hex << get_va(loop.src) << " -> "
-                      << get_va(loop.dst) << '\n';
-        }
-        std::clog << "\nUseless edges:\n";
-        for (auto const &edge : opt_cov.useless_edges()) {
-            std::clog << std::hex << get_va(edge.src) << " -> "
-                      << get_va(edge.dst) << '\n';
-        }
-        if (opt_cov.paths().size() < 32) {
-            std::clog << "\nOptimal paths:\n";
-            for (auto const &path : opt_cov.paths()) {
-                for (auto [jump, branch] : path) {
-                    std::clog << std::hex << get_va(jump)
-                              << (branch ? '+' : '-') << ' ';
-                }
-                std::clog << '\n';
+        std::clog << '\n';
+    }
+    std::clog << "\nNodes order:\n";
+    std::vector<Address> nodes_order(opt_cov.nodes_order().size());
+    for (auto [node, index] : opt_cov.nodes_order()) {
+        nodes_order[index] = node;
+    }
+    for (auto node : nodes_order) {
+        std::clog << std::hex << get_va(node) << '\n';
+    }
+    std::clog << "\nLoops:\n";
+    for (auto const &loop : opt_cov.loops()) {
+        std::clog << std::hex << get_va(loop.src) << " -> "
+                  << get_va(loop.dst) << '\n';
+    }
+    std::clog << "\nUseless edges:\n";
+    for (auto const &edge : opt_cov.useless_edges()) {
+        std::clog << std::hex << get_va(edge.src) << " -> "
+                  << get_va(edge.dst) << '\n';
+    }
+    if (opt_cov.paths().size() < 32) {
+        std::clog << "\nOptimal paths:\n";
+        for (auto const &path : opt_cov.paths()) {
+            for (auto [jump, branch] : path) {
+                std::clog << std::hex << get_va(jump)
+                          << (branch ? '+' : '-') << ' ';
             }
+            std::clog << '\n';
         }
-        std::clog << '\n';
+    }
+    std::clog << '\n';
 #endif
-        analyze_flo(flo,
-                    flo_contexts,
-                    optimal_paths_to_analyze_paths(opt_cov.paths()),
-                    make_flo_initial_contexts(flo),
-                    flo.entry_point);
-        for (auto const &cycle : opt_cov.loops()) {
-            flo.add_cycle(cycle.src, cycle.dst);
-        }
-        {
-            std::scoped_lock<std::mutex> add_contexts_guard(
-                modify_access_contexts_mutex_);
-            contexts_.emplace(flo.entry_point, std::move(flo_contexts));
+    // Nodes of contexts' registers and memory live as long as the contexts
+    auto &pool =
+        *analysis->pools.emplace_back(std::make_unique<utils::Pool>());
+    if (use_paths) {
+        analysis->tasks = 1;
+        analyze_flo(analysis,
+                    PathsGroup{ optimal_paths_to_analyze_paths(opt_cov.paths()),
+                                make_flo_initial_contexts(flo, pool),
+                                flo.entry_point });
+    }
+    else {
+        analyze_flo_dataflow(flo,
+                             analysis->flo_contexts,
+                             opt_cov,
+                             make_flo_initial_contexts(flo, pool));
+        publish_contexts(*analysis);
+    }
+}
+
+void Recontex::analyze_flo(std::shared_ptr<FloAnalysis> const &analysis,
+                           PathsGroup group)
+{
+    auto flo_contexts = analysis->flo_contexts.make_fragment();
+    BlockMemoStats memo_stats;
+    {
+        PathsState state;
+        // Groups split at jumps are kept on an explicit stack
+        // rather than the call stack, which deep path trees overflow
+        std::vector<PathsGroup> groups;
+        groups.push_back(std::move(group));
+        while (!groups.empty()) {
+            auto current = std::move(groups.back());
+            groups.pop_back();
+            size_t split = groups.size();
+            analyze_paths_group(analysis->flo,
+                                flo_contexts,
+                                state,
+                                std::move(current),
+                                groups);
+            if (!analysis->spawn) {
+                continue;
+            }
+            // Large groups split off this one go to other workers
+            auto large = std::stable_partition(
+                groups.begin() + split,
+                groups.end(),
+                [](PathsGroup const &group) {
+                    return group.paths.size() < min_spawned_paths_;
+                });
+            for (auto it = large; it != groups.end(); ++it) {
+                spawn_paths_group(analysis, std::move(*it));
+            }
+            groups.erase(large, groups.end());
         }
+        memo_stats = state.memo_stats;
+    }
+    {
+        std::scoped_lock<std::mutex> merge_guard(analysis->mutex);
+        analysis->flo_contexts.contexts.merge(flo_contexts.contexts);
+        analysis->memo_stats.hits += memo_stats.hits;
+        analysis->memo_stats.misses += memo_stats.misses;
+    }
+    if (--analysis->tasks == 0) {
+        publish_contexts(*analysis);
+    }
+}
+
+void Recontex::spawn_paths_group(std::shared_ptr<FloAnalysis> const &analysis,
+                                 PathsGroup group)
+{
+    // Reference counting of contexts' nodes isn't atomic,
+    // so the task gets deep copies allocated from a pool of its own
+    utils::Pool *pool;
+    {
+        std::scoped_lock<std::mutex> pools_guard(analysis->mutex);
+        pool = analysis->pools.emplace_back(std::make_unique<utils::Pool>())
+                   .get();
+    }
+    auto spawned = std::make_shared<PathsGroup>(
+        PathsGroup{ std::move(group.paths), Contexts(), group.address });
+    for (auto const &context : group.contexts) {
+        spawned->contexts.emplace(Context(context, pool));
+    }
+    analysis->tasks++;
+    executor_->submit([this, analysis, spawned] {
+        analyze_flo(analysis, std::move(*spawned));
     });
 }
 
-void Recontex::wait_for_analysis()
+void Recontex::publish_contexts(FloAnalysis &analysis)
 {
-    std::for_each(analyzing_threads_.begin(),
-                  analyzing_threads_.end(),
-                  [](std::thread &t) { t.join(); });
-    analyzing_threads_.clear();
+    auto &flo = analysis.flo;
+    for (auto const &cycle : analysis.opt_cov.loops()) {
+        flo.add_cycle(cycle.src, cycle.dst);
+    }
+    FloContexts frozen_contexts(std::move(analysis.flo_contexts.contexts));
+    {
+        std::scoped_lock<std::mutex> add_contexts_guard(
+            modify_access_contexts_mutex_);
+        pools_.emplace(flo.entry_point, std::move(analysis.pools));
+        contexts_.emplace(flo.entry_point, std::move(frozen_contexts));
+        block_memo_stats_.hits += analysis.memo_stats.hits;
+        block_memo_stats_.misses += analysis.memo_stats.misses;
+    }
 }
 
-void Recontex::analyze_flo(Flo &flo,
-                           FloContexts &flo_contexts,
-                           AnalyzePaths paths,
-                           Contexts contexts,
-                           Address address)
+void Recontex::analyze_paths_group(Flo &flo,
+                                   DiscoveredFloContexts &flo_contexts,
+                                   PathsState &state,
+                                   PathsGroup group,
+                                   std::vector<PathsGroup> &groups)
 {
+    auto paths = std::move(group.paths);
+    auto contexts = std::move(group.contexts);
+    auto address = group.address;
     auto next_node = paths.begin();
     // Assert all paths have the same next jump
     assert(same_analyze_path(paths));
     auto last_instr = flo.get_disassembly().rbegin();
     auto end = last_instr->first + last_instr->second->length;
+    // Block which is being emulated from its entry, and its entry contexts
+    Address block = address;
+    std::vector<size_t> block_hashes;
     while (address && address < end) {
         assert(!contexts.empty());
+        DecodedInstruction const *instr = nullptr;
+        if (address == block) {
+            block_hashes.clear();
+            for (auto const &context : contexts) {
+                block_hashes.push_back(context.get_hash());
+            }
+            if (auto result = find_block_result(state, block, block_hashes);
+                result) {
+                // Splice contexts after the closing jump of the block
+                state.memo_stats.hits++;
+                address = result->jump;
+                instr = result->instruction;
+                contexts = make_child_contexts(result->contexts);
+                block = nullptr;
+            }
+            else {
+                state.memo_stats.misses++;
+            }
+        }
+        if (!instr) {
 #ifdef DEBUG_CONTEXT_PROPAGATION
-        DWORD va = pe_.raw_to_virtual_address(address);
+            DWORD va = pe_.raw_to_virtual_address(address);
 #endif
-        auto propagation_result =
-            propagate_contexts(flo, flo_contexts, address, std::move(contexts));
-        contexts = std::move(propagation_result.new_contexts);
-        auto const instr = propagation_result.instruction;
+            auto propagation_result = propagate_contexts(flo,
+                                                         flo_contexts,
+                                                         address,
+                                                         std::move(contexts));
+            contexts = std::move(propagation_result.new_contexts);
+            instr = propagation_result.instruction;
 #ifdef DEBUG_CONTEXT_PROPAGATION
-        std::clog << std::dec << std::setfill(' ') << std::setw(5) << std::right
-                  << contexts.size() << "/" << std::setw(5) << std::left
-                  << flo_contexts.count(address);
-        if (instr) {
-            Dumper dumper;
-            dumper.dump_instruction(std::clog, va, *instr);
+            std::clog << std::dec << std::setfill(' ') << std::setw(5)
+                      << std::right << contexts.size() << "/" << std::setw(5)
+                      << std::left << flo_contexts.contexts.count(address);
+            if (instr) {
+                Dumper dumper;
+                dumper.dump_instruction(std::clog, va, *instr);
     #ifdef DEBUG_CONTEXT_PROPAGATION_VALUES
-            // Read values
-            for (size_t i = 0; i < instr->operand_count; i++) {
-                auto const &op = instr->operands[i];
-                if (!(op.actions & ZYDIS_OPERAND_ACTION_MASK_READ)) {
-                    continue;
-                }
-                for (auto const &context : contexts) {
-                    switch (op.type) {
-                    case ZYDIS_OPERAND_TYPE_REGISTER:
-                        if (op.visibility
-                            == ZYDIS_OPERAND_VISIBILITY_EXPLICIT) {
-                            dump_register_value(std::clog,
-                                                dumper,
-                                                reflo_,
-                                                context,
-                                                op.reg.value);
-                        }
-                        break;
-                    case ZYDIS_OPERAND_TYPE_MEMORY:
-                        if (op.mem.base != ZYDIS_REGISTER_NONE
-                            && op.mem.base != ZYDIS_REGISTER_RIP) {
-                            dump_register_value(std::clog,
-                                                dumper,
-                                                reflo_,
-                                                context,
-                                                op.mem.base);
-                        }
-                        if (op.mem.index != ZYDIS_REGISTER_NONE) {
-                            dump_register_value(std::clog,
-                                                dumper,
-                                                reflo_,
-                                                context,
-                                                op.mem.index);
+                // Read values
+                for (size_t i = 0; i < instr->operand_count; i++) {
+                    auto const &op = instr->operands[i];
+                    if (!(op.actions & ZYDIS_OPERAND_ACTION_MASK_READ)) {
+                        continue;
+                    }
+                    for (auto const &context : contexts) {
+                        switch (op.type) {
+                        case ZYDIS_OPERAND_TYPE_REGISTER:
+                            if (op.visibility
+                                == ZYDIS_OPERAND_VISIBILITY_EXPLICIT) {
+                                dump_register_value(std::clog,
+                                                    dumper,
+                                                    reflo_,
+                                                    context,
+                                                    op.reg.value);
+                            }
+                            break;
+                        case ZYDIS_OPERAND_TYPE_MEMORY:
+                            if (op.mem.base != ZYDIS_REGISTER_NONE
+                                && op.mem.base != ZYDIS_REGISTER_RIP) {
+                                dump_register_value(std::clog,
+                                                    dumper,
+                                                    reflo_,
+                                                    context,
+                                                    op.mem.base);
+                            }
+                            if (op.mem.index != ZYDIS_REGISTER_NONE) {
+                                dump_register_value(std::clog,
+                                                    dumper,
+                                                    reflo_,
+                                                    context,
+                                                    op.mem.index);
+                            }
+                            break;
+                        default: break;
                         }
-                        break;
-                    default: break;
                     }
                 }
-            }
     #endif
-        }
-        else {
-            std::clog << std::hex << std::setfill('0') << std::setw(8)
-                      << std::right << pe_.raw_to_virtual_address(address)
-                      << '\n';
-        }
+            }
+            else {
+                std::clog << std::hex << std::setfill('0') << std::setw(8)
+                          << std::right << pe_.raw_to_virtual_address(address)
+                          << '\n';
+            }
 #endif
-        if (!instr || contexts.empty()) {
-            break;
+            if (!instr || contexts.empty()) {
+                break;
+            }
+            if (block && Flo::is_any_jump(instr->mnemonic)) {
+                state.memo[block].push_back(
+                    BlockResult{ std::move(block_hashes),
+                                 address,
+                                 instr,
+                                 make_child_contexts(contexts) });
+                block = nullptr;
+            }
         }
         assert(next_node->current == next_node->end
                || next_node->current->jump >= address);
@@ -307,11 +489,9 @@ void Recontex::analyze_flo(Flo &flo,
             auto skip_jump_paths = split_analyze_paths(paths);
             if (!skip_jump_paths.empty()) {
                 advance_analyze_paths(skip_jump_paths);
-                analyze_flo(flo,
-                            flo_contexts,
-                            std::move(skip_jump_paths),
-                            make_child_contexts(contexts),
-                            address + instr->length);
+                groups.push_back(PathsGroup{ std::move(skip_jump_paths),
+                                             make_child_contexts(contexts),
+                                             address + instr->length });
             }
             if (paths.empty()) {
                 return;
@@ -320,6 +500,7 @@ void Recontex::analyze_flo(Flo &flo,
             auto const &op = instr->operands[0];
             assert(op.type == ZYDIS_OPERAND_TYPE_IMMEDIATE);
             address += instr->length + op.imm.value.s;
+            block = address;
             advance_analyze_paths(paths);
             assert(same_analyze_path(paths));
             next_node = paths.begin();
@@ -341,6 +522,144 @@ void Recontex::analyze_flo(Flo &flo,
     }
 }
 
+Recontex::BlockResult const *
+Recontex::find_block_result(PathsState const &state,
+                            Address block,
+                            std::vector<size_t> const &hashes)
+{
+    auto it = state.memo.find(block);
+    if (it == state.memo.end()) {
+        return nullptr;
+    }
+    for (auto const &result : it->second) {
+        if (result.hashes == hashes) {
+            return &result;
+        }
+    }
+    return nullptr;
+}
+
+void Recontex::analyze_flo_dataflow(Flo &flo,
+                                    DiscoveredFloContexts &flo_contexts,
+                                    OptimalCoverage &opt_cov,
+                                    Contexts contexts)
+{
+    DataflowState state;
+    auto const &disassembly = flo.get_disassembly();
+    for (auto const &[address, instr] : disassembly) {
+        if (!Flo::is_any_jump(instr->mnemonic)) {
+            continue;
+        }
+        if (auto dst = Flo::get_jump_destination(address, *instr);
+            dst && flo.is_inside(dst)) {
+            state.leaders.insert(dst);
+        }
+        if (Flo::is_conditional_jump(instr->mnemonic)) {
+            state.leaders.insert(address + instr->length);
+        }
+    }
+    // Loop edges are found between nodes, i.e. groups of jumps,
+    // remember the exact jumps which take them.
+    for (auto const &[_, node] : opt_cov.nodes()) {
+        for (auto const &branch : node.branches) {
+            if (opt_cov.loops().contains(
+                    OptimalCoverage::Edge(node.source, branch.branch))) {
+                state.loop_edges.emplace(branch.source, branch.branch);
+            }
+        }
+    }
+    flow_contexts(opt_cov,
+                  state,
+                  nullptr,
+                  flo.entry_point,
+                  std::move(contexts));
+    while (!state.pending.empty()) {
+        auto pending = state.pending.extract(state.pending.begin());
+        analyze_block(flo,
+                      flo_contexts,
+                      opt_cov,
+                      state,
+                      pending.key(),
+                      std::move(pending.mapped()));
+    }
+}
+
+void Recontex::analyze_block(Flo &flo,
+                             DiscoveredFloContexts &flo_contexts,
+                             OptimalCoverage &opt_cov,
+                             DataflowState &state,
+                             Address address,
+                             Contexts contexts)
+{
+    while (true) {
+        auto propagation_result =
+            propagate_contexts(flo, flo_contexts, address, std::move(contexts));
+        contexts = std::move(propagation_result.new_contexts);
+        auto const instr = propagation_result.instruction;
+        if (!instr || contexts.empty()) {
+            return;
+        }
+        Address next = address + instr->length;
+        if (Flo::is_any_jump(instr->mnemonic)) {
+            if (Flo::is_conditional_jump(instr->mnemonic)) {
+                flow_contexts(opt_cov,
+                              state,
+                              address,
+                              next,
+                              make_child_contexts(contexts));
+            }
+            if (auto dst = Flo::get_jump_destination(address, *instr);
+                dst && flo.is_inside(dst)) {
+                flow_contexts(opt_cov,
+                              state,
+                              address,
+                              dst,
+                              std::move(contexts));
+            }
+            return;
+        }
+        if (instr->mnemonic == ZYDIS_MNEMONIC_RET) {
+            return;
+        }
+        if (state.leaders.contains(next)) {
+            flow_contexts(opt_cov, state, address, next, std::move(contexts));
+            return;
+        }
+        address = next;
+    }
+}
+
+void Recontex::flow_contexts(OptimalCoverage &opt_cov,
+                             DataflowState &state,
+                             Address src,
+                             Address dst,
+                             Contexts contexts)
+{
+    // Widening: contexts coming around a loop are different every time
+    // (the hash depends on history), so a loop edge is taken only
+    // a limited amount of times, as in the paths engine.
+    if (src) {
+        auto const &nodes = opt_cov.nodes();
+        if (auto it = nodes.lower_bound(dst); it != nodes.end()) {
+            OptimalCoverage::Edge edge(src, it->first);
+            if (state.loop_edges.contains(edge)
+                && state.loop_passes[edge]++ >= max_loop_passes_) {
+                return;
+            }
+        }
+    }
+    // Join: contexts are accumulated at the block entry up to a limit,
+    // only the contexts that were not seen there yet are propagated.
+    auto &entered = state.entered[dst];
+    while (!contexts.empty() && entered.size() < max_block_contexts_) {
+        auto context = contexts.pop();
+        if (auto [_, inserted] = entered.insert(context.get_hash());
+            inserted) {
+            state.pending[dst].emplace(std::move(context));
+        }
+    }
+}
+
 Recontex::AnalyzePaths
 Recontex::optimal_paths_to_analyze_paths(OptimalCoverage::Paths const &paths)
 {
@@ -390,7 +709,7 @@ bool Recontex::same_analyze_path(AnalyzePaths const &paths)
 
 Recontex::PropagationResult
 Recontex::propagate_contexts(Flo const &flo,
-                             FloContexts &flo_contexts,
+                             DiscoveredFloContexts &flo_contexts,
                              Address address,
                              Contexts contexts)
 {
@@ -399,35 +718,70 @@ Recontex::propagate_contexts(Flo const &flo,
     if (!result.instruction) {
         return result;
     }
+    Liveness::Registers dead = 0;
+    if (flo_contexts.liveness) {
+        dead = flo_contexts.liveness->get_newly_dead(address);
+    }
+    if (!flo_contexts.is_recorded(address)) {
+        // Nobody reads contexts here, emulate them in place
+        while (!contexts.empty()) {
+            auto context = contexts.pop();
+            emulate(address, *result.instruction, context);
+            canonicalize_registers(context, dead);
+            result.new_contexts.emplace(std::move(context));
+        }
+        return result;
+    }
     while (!contexts.empty()) {
         auto const &context =
             emplace_context(flo_contexts, address, contexts.pop());
         auto new_context = context.make_child();
         emulate(address, *result.instruction, new_context);
+        canonicalize_registers(new_context, dead);
         result.new_contexts.emplace(std::move(new_context));
     }
     return result;
 }
 
-Context const &Recontex::emplace_context(FloContexts &flo_contexts,
+void Recontex::canonicalize_registers(Context &context,
+                                      Liveness::Registers registers)
+{
+    // Contexts which differ only in dead registers become equal
+    for (; registers; registers &= registers - 1) {
+        auto reg = static_cast<virt::Registers::Reg>(
+            std::countr_zero(registers));
+        auto zydis_reg = virt::Registers::to_zydis(reg);
+        if (auto value = context.get_register(zydis_reg);
+            value && value->is_symbolic()
+            && value->symbol().id() == dead_register_id_) {
+            continue;
+        }
+        context.set_register(
+            zydis_reg,
+            virt::make_symbolic_value(nullptr, 8, 0, dead_register_id_));
+    }
+}
+
+Context const &Recontex::emplace_context(DiscoveredFloContexts &flo_contexts,
                                          Address address,
                                          Context &&context)
 {
-    auto range = utils::in_range(flo_contexts.equal_range(address));
+    auto range = utils::in_range(flo_contexts.contexts.equal_range(address));
     auto insert_hint = std::upper_bound(range.begin(),
                                         range.end(),
                                         context.get_hash(),
                                         [](size_t hash, auto const &it) {
                                             return hash < it.second.get_hash();
                                         });
-    auto emplaced = flo_contexts.emplace_hint(insert_hint,
-                                              address,
-                                              std::forward<Context>(context));
+    auto emplaced =
+        flo_contexts.contexts.emplace_hint(insert_hint,
+                                           address,
+                                           std::forward<Context>(context));
     return emplaced->second;
 }
 
 void Recontex::emulate(Address address,
-                       ZydisDecodedInstruction const &instruction,
+                       DecodedInstruction const &instruction,
                        Context &context)
 {
     assert(address);
@@ -436,99 +790,69 @@ void Recontex::emulate(Address address,
     // * (A)L, (A)H, (A)X / 8, 16 bits - do not affect HO bits
     // * E(A)X / 32 bits - zerorize HO bits.
 
-    using namespace std::placeholders;
-
-    switch (instruction.mnemonic) {
-    case ZYDIS_MNEMONIC_MOV:
-    case ZYDIS_MNEMONIC_MOVZX:
-    case ZYDIS_MNEMONIC_MOVSX:
-    case ZYDIS_MNEMONIC_MOVSXD: {
-        emulate_instruction(
-            instruction,
-            context,
-            address,
-            [](virt::Value const &dst, virt::Value const &src) -> virt::Value {
-                uintptr_t mask = ~0;
-                if (dst.size() < 8) {
-                    mask = (1ULL << (dst.size() * 8)) - 1;
-                }
-                if (!dst.is_symbolic() && !src.is_symbolic()
-                    && dst.size() < 4) {
-                    return virt::make_value(src.source(),
-                                            (dst.value() & ~mask)
-                                                | (src.value() & mask),
-                                            dst.size());
-                }
-                else if (!src.is_symbolic()) {
-                    return virt::make_value(src.source(),
-                                            src.value() & mask,
-                                            dst.size());
-                }
-                else {
-                    return src;
-                }
-            });
-    } break;
-    case ZYDIS_MNEMONIC_ADD:
-    case ZYDIS_MNEMONIC_SUB:
-    case ZYDIS_MNEMONIC_OR:
-    case ZYDIS_MNEMONIC_AND:
-    case ZYDIS_MNEMONIC_XOR:
-    case ZYDIS_MNEMONIC_IMUL: {
-        auto action = emulation_callback_actions_.at(instruction.mnemonic);
-        auto callback =
-            std::bind(&Recontex::emulate_instruction_helper, _1, _2, action);
-        emulate_instruction(instruction, context, address, callback);
-    } break;
-    case ZYDIS_MNEMONIC_LEA:
-        emulate_instruction_lea(instruction, context, address);
-        break;
-    case ZYDIS_MNEMONIC_PUSH:
-        emulate_instruction_push(instruction, context, address);
-        break;
-    case ZYDIS_MNEMONIC_POP:
-        emulate_instruction_pop(instruction, context, address);
-        break;
-    case ZYDIS_MNEMONIC_CALL:
-        emulate_instruction_call(instruction, context, address);
-        break;
-    case ZYDIS_MNEMONIC_RET:
-        emulate_instruction_ret(instruction, context, address);
-        break;
-    case ZYDIS_MNEMONIC_INC:
-        emulate_instruction_inc(instruction, context, address, +1);
-        break;
-    case ZYDIS_MNEMONIC_DEC:
-        emulate_instruction_inc(instruction, context, address, -1);
-        break;
-    default:
-        for (size_t i = 0; i < instruction.operand_count; i++) {
-            auto const &op = instruction.operands[i];
-            if (!(op.actions & ZYDIS_OPERAND_ACTION_MASK_WRITE)) {
-                continue;
-            }
-            switch (op.type) {
-            case ZYDIS_OPERAND_TYPE_REGISTER:
-                context.set_register(
-                    op.reg.value,
-                    virt::make_symbolic_value(address, op.element_size / 8));
-                break;
-            case ZYDIS_OPERAND_TYPE_MEMORY:
-                context.set_memory(
-                    get_memory_address(op, context).raw_address_value(),
-                    virt::make_symbolic_value(address, op.element_size / 8));
-                break;
-            default: break;
-            }
+    auto kind = emulation_kinds_[instruction.mnemonic];
+    auto shape = get_operand_shape(instruction);
+    emulation_handlers_[kind][shape](instruction, context, address);
+}
+
+void Recontex::emulate_default(DecodedInstruction const &instruction,
+                               Context &context,
+                               Address address)
+{
+    for (size_t i = 0; i < instruction.operand_count; i++) {
+        auto const &op = instruction.operands[i];
+        if (!(op.actions & ZYDIS_OPERAND_ACTION_MASK_WRITE)) {
+            continue;
+        }
+        switch (op.type) {
+        case ZYDIS_OPERAND_TYPE_REGISTER:
+            context.set_register(
+                op.reg.value,
+                virt::make_symbolic_value(address, op.element_size / 8));
+            break;
+        case ZYDIS_OPERAND_TYPE_MEMORY:
+            context.set_memory(
+                get_memory_address(op, context).raw_address_value(),
+                virt::make_symbolic_value(address, op.element_size / 8));
+            break;
+        default: break;
+        }
+    }
+}
+
+template<typename Operation, ZydisOperandType DstType, ZydisOperandType SrcType>
+void Recontex::emulate_instruction(DecodedInstruction const &instruction,
+                                   Context &context,
+                                   Address address)
+{
+    Operand dst =
+        get_operand<DstType>(instruction.operands[0], context, address);
+    Operand src =
+        get_operand<SrcType>(instruction.operands[1], context, address);
+    if constexpr (std::is_same_v<Operation, XorOperation>
+                  && DstType == ZYDIS_OPERAND_TYPE_REGISTER
+                  && SrcType == ZYDIS_OPERAND_TYPE_REGISTER) {
+        if (dst.reg == src.reg) {
+            dst.value = virt::make_value(
+                address,
+                0,
+                instruction.operands[1].element_size / 8);
+        }
+        else {
+            dst.value = Operation::combine(dst.value, src.value);
         }
-        break;
     }
+    else {
+        dst.value = Operation::combine(dst.value, src.value);
+    }
+    dst.value.set_source(address);
+    set_operand(context, dst);
 }
 
-void Recontex::emulate_instruction(ZydisDecodedInstruction const &instruction,
+template<typename Operation>
+void Recontex::emulate_instruction(DecodedInstruction const &instruction,
                                    Context &context,
-                                   Address address,
-                                   EmulationCallback const &callback)
+                                   Address address)
 {
     Operand dst = get_operand(instruction.operands[0], context, address);
     Operand src;
@@ -550,35 +874,31 @@ void Recontex::emulate_instruction(ZydisDecodedInstruction const &instruction,
             }
         }
     }
-    if (instruction.mnemonic == ZYDIS_MNEMONIC_XOR && dst.reg == src.reg) {
+    if (std::is_same_v<Operation, XorOperation>
+        && dst.reg != ZYDIS_REGISTER_NONE && dst.reg == src.reg) {
         dst.value = virt::make_value(address,
                                      0,
                                      instruction.operands[1].element_size / 8);
     }
     else {
         if (op_count == 2) {
-            dst.value = callback(dst.value, src.value);
+            dst.value = Operation::combine(dst.value, src.value);
         }
         else if (instruction.operands[2].type == ZYDIS_OPERAND_TYPE_IMMEDIATE) {
             // TODO: use dst, if needed
             // for now, assume it's unused.
-            dst.value = callback(src.value, imm);
+            dst.value = Operation::combine(src.value, imm);
         }
         else {
             dst.value = virt::make_symbolic_value(address, dst.value.size());
         }
     }
     dst.value.set_source(address);
-    if (dst.reg != ZYDIS_REGISTER_NONE) {
-        context.set_register(dst.reg, dst.value);
-    }
-    else if (dst.address) {
-        context.set_memory(*dst.address, dst.value);
-    }
+    set_operand(context, dst);
 }
 
 void Recontex::emulate_instruction_lea(
-    ZydisDecodedInstruction const &instruction,
+    DecodedInstruction const &instruction,
     Context &context,
     Address address)
 {
@@ -591,7 +911,7 @@ void Recontex::emulate_instruction_lea(
 }
 
 void Recontex::emulate_instruction_push(
-    ZydisDecodedInstruction const &instruction,
+    DecodedInstruction const &instruction,
     Context &context,
     Address address)
 {
@@ -608,7 +928,7 @@ void Recontex::emulate_instruction_push(
 }
 
 void Recontex::emulate_instruction_pop(
-    ZydisDecodedInstruction const &instruction,
+    DecodedInstruction const &instruction,
     Context &context,
     Address address)
 {
@@ -630,7 +950,7 @@ void Recontex::emulate_instruction_pop(
 }
 
 void Recontex::emulate_instruction_call(
-    ZydisDecodedInstruction const &instruction,
+    DecodedInstruction const &instruction,
     Context &context,
     Address address)
 {
@@ -655,7 +975,7 @@ void Recontex::emulate_instruction_call(
 }
 
 void Recontex::emulate_instruction_ret(
-    ZydisDecodedInstruction const &instruction,
+    DecodedInstruction const &instruction,
     Context &context,
     Address address)
 {
@@ -668,11 +988,11 @@ void Recontex::emulate_instruction_ret(
     }
 }
 
+template<int offset>
 void Recontex::emulate_instruction_inc(
-    ZydisDecodedInstruction const &instruction,
+    DecodedInstruction const &instruction,
     Context &context,
-    Address address,
-    int offset)
+    Address address)
 {
     assert(instruction.mnemonic == ZYDIS_MNEMONIC_INC
            || instruction.mnemonic == ZYDIS_MNEMONIC_DEC);
@@ -695,52 +1015,165 @@ void Recontex::emulate_instruction_inc(
     }
 }
 
-virt::Value Recontex::emulate_instruction_helper(
-    virt::Value const &dst,
-    virt::Value const &src,
-    std::function<uintptr_t(uintptr_t, uintptr_t)> action)
+Recontex::OperandShape
+Recontex::get_operand_shape(DecodedInstruction const &instruction)
 {
-    if (!dst.is_symbolic() && !src.is_symbolic()) {
-        uintptr_t mask = ~0;
-        if (dst.size() < 8) {
-            mask = (1ULL << (dst.size() * 8)) - 1;
-        }
-        if (dst.size() < 4) {
-            return virt::make_value(
-                src.source(),
-                (dst.value() & ~mask)
-                    | (action(dst.value(), src.value()) & mask),
-                dst.size());
+    if (instruction.operand_count < 2
+        || instruction.operands[1].visibility
+               != ZYDIS_OPERAND_VISIBILITY_EXPLICIT
+        || (instruction.operand_count >= 3
+            && instruction.operands[2].visibility
+                   == ZYDIS_OPERAND_VISIBILITY_EXPLICIT)) {
+        return OPERAND_SHAPE_GENERIC;
+    }
+    auto dst = instruction.operands[0].type;
+    auto src = instruction.operands[1].type;
+    if (dst == ZYDIS_OPERAND_TYPE_REGISTER) {
+        switch (src) {
+        case ZYDIS_OPERAND_TYPE_REGISTER: return OPERAND_SHAPE_REG_REG;
+        case ZYDIS_OPERAND_TYPE_IMMEDIATE: return OPERAND_SHAPE_REG_IMM;
+        case ZYDIS_OPERAND_TYPE_MEMORY: return OPERAND_SHAPE_REG_MEM;
+        default: break;
         }
-        else {
-            return virt::make_value(src.source(),
-                                    action(dst.value(), src.value()) & mask,
-                                    dst.size());
+    }
+    else if (dst == ZYDIS_OPERAND_TYPE_MEMORY) {
+        switch (src) {
+        case ZYDIS_OPERAND_TYPE_REGISTER: return OPERAND_SHAPE_MEM_REG;
+        case ZYDIS_OPERAND_TYPE_IMMEDIATE: return OPERAND_SHAPE_MEM_IMM;
+        default: break;
         }
     }
-    else if (dst.is_symbolic() && !src.is_symbolic()) {
-        return virt::make_symbolic_value(
-            src.source(),
-            dst.size(),
-            action(dst.symbol().offset(), src.value()),
-            dst.symbol().id());
+    return OPERAND_SHAPE_GENERIC;
+}
+
+template<typename Operation>
+constexpr Recontex::EmulationHandlers Recontex::make_emulation_handlers()
+{
+    EmulationHandlers handlers{};
+    handlers[OPERAND_SHAPE_REG_REG] =
+        &emulate_instruction<Operation,
+                             ZYDIS_OPERAND_TYPE_REGISTER,
+                             ZYDIS_OPERAND_TYPE_REGISTER>;
+    handlers[OPERAND_SHAPE_REG_IMM] =
+        &emulate_instruction<Operation,
+                             ZYDIS_OPERAND_TYPE_REGISTER,
+                             ZYDIS_OPERAND_TYPE_IMMEDIATE>;
+    handlers[OPERAND_SHAPE_REG_MEM] =
+        &emulate_instruction<Operation,
+                             ZYDIS_OPERAND_TYPE_REGISTER,
+                             ZYDIS_OPERAND_TYPE_MEMORY>;
+    handlers[OPERAND_SHAPE_MEM_REG] =
+        &emulate_instruction<Operation,
+                             ZYDIS_OPERAND_TYPE_MEMORY,
+                             ZYDIS_OPERAND_TYPE_REGISTER>;
+    handlers[OPERAND_SHAPE_MEM_IMM] =
+        &emulate_instruction<Operation,
+                             ZYDIS_OPERAND_TYPE_MEMORY,
+                             ZYDIS_OPERAND_TYPE_IMMEDIATE>;
+    handlers[OPERAND_SHAPE_GENERIC] = &emulate_instruction<Operation>;
+    return handlers;
+}
+
+constexpr Recontex::EmulationHandlers
+Recontex::make_emulation_handlers(EmulationHandler handler)
+{
+    EmulationHandlers handlers{};
+    handlers.fill(handler);
+    return handlers;
+}
+
+std::array<Recontex::EmulationHandlers, Recontex::EMULATION_KINDS_COUNT> const
+    Recontex::emulation_handlers_ = {
+        make_emulation_handlers(&emulate_default),
+        make_emulation_handlers<MovOperation>(),
+        make_emulation_handlers<AddOperation>(),
+        make_emulation_handlers<SubOperation>(),
+        make_emulation_handlers<OrOperation>(),
+        make_emulation_handlers<AndOperation>(),
+        make_emulation_handlers<XorOperation>(),
+        make_emulation_handlers<ImulOperation>(),
+        make_emulation_handlers(&emulate_instruction_lea),
+        make_emulation_handlers(&emulate_instruction_push),
+        make_emulation_handlers(&emulate_instruction_pop),
+        make_emulation_handlers(&emulate_instruction_call),
+        make_emulation_handlers(&emulate_instruction_ret),
+        make_emulation_handlers(&emulate_instruction_inc<+1>),
+        make_emulation_handlers(&emulate_instruction_inc<-1>),
+    };
+
+std::array<Recontex::EmulationKind, ZYDIS_MNEMONIC_MAX_VALUE + 1> const
+    Recontex::emulation_kinds_ = [] {
+        std::array<EmulationKind, ZYDIS_MNEMONIC_MAX_VALUE + 1> kinds{};
+        kinds.fill(EMULATION_KIND_DEFAULT);
+        kinds[ZYDIS_MNEMONIC_MOV] = EMULATION_KIND_MOV;
+        kinds[ZYDIS_MNEMONIC_MOVZX] = EMULATION_KIND_MOV;
+        kinds[ZYDIS_MNEMONIC_MOVSX] = EMULATION_KIND_MOV;
+        kinds[ZYDIS_MNEMONIC_MOVSXD] = EMULATION_KIND_MOV;
+        kinds[ZYDIS_MNEMONIC_ADD] = EMULATION_KIND_ADD;
+        kinds[ZYDIS_MNEMONIC_SUB] = EMULATION_KIND_SUB;
+        kinds[ZYDIS_MNEMONIC_OR] = EMULATION_KIND_OR;
+        kinds[ZYDIS_MNEMONIC_AND] = EMULATION_KIND_AND;
+        kinds[ZYDIS_MNEMONIC_XOR] = EMULATION_KIND_XOR;
+        kinds[ZYDIS_MNEMONIC_IMUL] = EMULATION_KIND_IMUL;
+        kinds[ZYDIS_MNEMONIC_LEA] = EMULATION_KIND_LEA;
+        kinds[ZYDIS_MNEMONIC_PUSH] = EMULATION_KIND_PUSH;
+        kinds[ZYDIS_MNEMONIC_POP] = EMULATION_KIND_POP;
+        kinds[ZYDIS_MNEMONIC_CALL] = EMULATION_KIND_CALL;
+        kinds[ZYDIS_MNEMONIC_RET] = EMULATION_KIND_RET;
+        kinds[ZYDIS_MNEMONIC_INC] = EMULATION_KIND_INC;
+        kinds[ZYDIS_MNEMONIC_DEC] = EMULATION_KIND_DEC;
+        return kinds;
+    }();
+
+void Recontex::set_operand(Context &context, Operand const &operand)
+{
+    if (operand.reg != ZYDIS_REGISTER_NONE) {
+        context.set_register(operand.reg, operand.value);
+    }
+    else if (operand.address) {
+        context.set_memory(*operand.address, operand.value);
     }
-    return virt::make_symbolic_value(src.source(), dst.size());
 }
 
-Recontex::Operand Recontex::get_operand(ZydisDecodedOperand const &operand,
+Recontex::Operand Recontex::get_operand(DecodedOperand const &operand,
                                         Context const &context,
                                         Address source)
 {
-    Operand op;
     switch (operand.type) {
-    case ZYDIS_OPERAND_TYPE_IMMEDIATE: {
+    case ZYDIS_OPERAND_TYPE_IMMEDIATE:
+        return get_operand<ZYDIS_OPERAND_TYPE_IMMEDIATE>(operand,
+                                                         context,
+                                                         source);
+    case ZYDIS_OPERAND_TYPE_REGISTER:
+        return get_operand<ZYDIS_OPERAND_TYPE_REGISTER>(operand,
+                                                        context,
+                                                        source);
+    case ZYDIS_OPERAND_TYPE_MEMORY:
+        return get_operand<ZYDIS_OPERAND_TYPE_MEMORY>(operand,
+                                                      context,
+                                                      source);
+    default: {
+        Operand op;
+        op.value = virt::make_symbolic_value(source, operand.element_size / 8);
+        return op;
+    }
+    }
+}
+
+template<ZydisOperandType Type>
+Recontex::Operand Recontex::get_operand(DecodedOperand const &operand,
+                                        Context const &context,
+                                        Address source)
+{
+    assert(operand.type == Type);
+    Operand op;
+    if constexpr (Type == ZYDIS_OPERAND_TYPE_IMMEDIATE) {
         op.value = virt::make_value(
             source,
             operand.imm.is_signed ? operand.imm.value.s : operand.imm.value.u,
             operand.element_size / 8);
-    } break;
-    case ZYDIS_OPERAND_TYPE_REGISTER: {
+    }
+    else if constexpr (Type == ZYDIS_OPERAND_TYPE_REGISTER) {
         op.reg = operand.reg.value;
         if (auto valsrc = context.get_register(op.reg); valsrc) {
             op.value = *valsrc;
@@ -750,8 +1183,8 @@ Recontex::Operand Recontex::get_operand(ZydisDecodedOperand const &operand,
             op.value =
                 virt::make_symbolic_value(source, operand.element_size / 8);
         }
-    } break;
-    case ZYDIS_OPERAND_TYPE_MEMORY: {
+    }
+    else if constexpr (Type == ZYDIS_OPERAND_TYPE_MEMORY) {
         op.address = get_memory_address(operand, context).raw_address_value();
         if (op.address && operand.element_size) {
             op.value =
@@ -761,15 +1194,11 @@ Recontex::Operand Recontex::get_operand(ZydisDecodedOperand const &operand,
             op.value =
                 virt::make_symbolic_value(source, operand.element_size / 8);
         }
-    } break;
-    default:
-        op.value = virt::make_symbolic_value(source, operand.element_size / 8);
-        break;
     }
     return op;
 }
 
-virt::Value Recontex::get_memory_address(ZydisDecodedOperand const &op,
+virt::Value Recontex::get_memory_address(DecodedOperand const &op,
                                          Context const &context)
 {
     assert(op.type == ZYDIS_OPERAND_TYPE_MEMORY);
@@ -835,7 +1264,7 @@ bool Recontex::points_to_stack(ZydisRegister reg,
     if (reg == ZYDIS_REGISTER_RSP) {
         return true;
     }
-    for (auto const &context : utils::multimap_values(flo_contexts, address)) {
+    for (auto const &context : flo_contexts.get(address)) {
         if (auto value = context.get_register(reg);
             value && !value->is_symbolic()) {
             if (points_to_stack(value->value())) {
@@ -859,9 +1288,9 @@ unsigned rstc::Recontex::stack_argument_number(uintptr_t value)
     return offset / 8 - 1;
 }
 
-Contexts Recontex::make_flo_initial_contexts(Flo &flo)
+Contexts Recontex::make_flo_initial_contexts(Flo &flo, utils::Pool &pool)
 {
-    auto c = Context(nullptr);
+    auto c = Context(nullptr, &pool);
     c.set_register(ZYDIS_REGISTER_RSP,
                    virt::make_value(flo.entry_point, magic_stack_value_ << 32));
     Contexts contexts;
@@ -869,29 +1298,52 @@ Contexts Recontex::make_flo_initial_contexts(Flo &flo)
     return contexts;
 }
 
+void Recontex::find_recorded_instructions(
+    Flo const &flo,
+    OptimalCoverage &opt_cov,
+    DiscoveredFloContexts &flo_contexts)
+{
+    if (recording_ == Recording::All) {
+        flo_contexts.record_all = true;
+        return;
+    }
+    for (auto const &[address, instr] : flo.get_disassembly()) {
+        if (instruction_has_memory_access(*instr)
+            || instr->mnemonic == ZYDIS_MNEMONIC_CALL
+            || Flo::is_any_jump(instr->mnemonic)) {
+            flo_contexts.recorded.insert(address);
+        }
+    }
+    // Cycles are added from loops, see `publish_contexts`
+    for (auto const &loop : opt_cov.loops()) {
+        flo_contexts.recorded.insert(loop.src);
+        flo_contexts.recorded.insert(loop.dst);
+    }
+}
+
 bool Recontex::instruction_has_memory_access(
-    ZydisDecodedInstruction const &instr)
+    DecodedInstruction const &instr)
 {
     return std::any_of(instr.operands,
                        instr.operands + instr.operand_count,
                        operand_has_memory_access);
 }
 
-bool Recontex::operand_has_memory_access(ZydisDecodedOperand const &op)
+bool Recontex::operand_has_memory_access(DecodedOperand const &op)
 {
     return op.type == ZYDIS_OPERAND_TYPE_MEMORY
            && op.visibility == ZYDIS_OPERAND_VISIBILITY_EXPLICIT;
 }
 
 bool Recontex::instruction_has_nonstack_memory_access(
-    ZydisDecodedInstruction const &instr)
+    DecodedInstruction const &instr)
 {
     return std::any_of(instr.operands,
                        instr.operands + instr.operand_count,
                        operand_has_nonstack_memory_access);
 }
 
-bool Recontex::operand_has_nonstack_memory_access(ZydisDecodedOperand const &op)
+bool Recontex::operand_has_nonstack_memory_access(DecodedOperand const &op)
 {
     return op.type == ZYDIS_OPERAND_TYPE_MEMORY
            && op.visibility == ZYDIS_OPERAND_VISIBILITY_EXPLICIT
@@ -899,7 +1351,7 @@ bool Recontex::operand_has_nonstack_memory_access(ZydisDecodedOperand const &op)
            && op.mem.index != ZYDIS_REGISTER_RSP;
 }
 
-bool Recontex::is_history_term_instr(ZydisDecodedInstruction const &instr)
+bool Recontex::is_history_term_instr(DecodedInstruction const &instr)
 {
     if (instr.mnemonic == ZYDIS_MNEMONIC_XOR) {
         auto const &dst = instr.operands[0];
@@ -969,7 +1421,7 @@ void Recontex::dump_register_history(std::ostream &os,
 void Recontex::dump_memory_history(std::ostream &os,
                                    Dumper const &dumper,
                                    Context const &context,
-                                   ZydisDecodedOperand const &op,
+                                   DecodedOperand const &op,
                                    std::unordered_set<Address> &visited) const
 {
     auto mem_addr =
@@ -999,8 +1451,8 @@ void Recontex::dump_instruction_history(
     std::ostream &os,
     Dumper const &dumper,
     Address address,
-    ZydisDecodedInstruction const &instr,
-    std::vector<Context const *> const &contexts,
+    DecodedInstruction const &instr,
+    std::span<Context const> contexts,
     std::unordered_set<Address> visited) const
 {
     visited.emplace(address);
@@ -1020,7 +1472,7 @@ void Recontex::dump_instruction_history(
                 if (op.visibility == ZYDIS_OPERAND_VISIBILITY_EXPLICIT) {
                     dump_register_history(os,
                                           dumper,
-                                          *context,
+                                          context,
                                           op.reg.value,
                                           visited);
                 }
@@ -1030,18 +1482,18 @@ void Recontex::dump_instruction_history(
                     && op.mem.base != ZYDIS_REGISTER_RIP) {
                     dump_register_history(os,
                                           dumper,
-                                          *context,
+                                          context,
                                           op.mem.base,
                                           visited);
                 }
                 if (op.mem.index != ZYDIS_REGISTER_NONE) {
                     dump_register_history(os,
                                           dumper,
-                                          *context,
+                                          context,
                                           op.mem.index,
                                           visited);
                 }
-                dump_memory_history(os, dumper, *context, op, visited);
+                dump_memory_history(os, dumper, context, op, visited);
                 break;
             default: break;
             }
@@ -1064,7 +1516,6 @@ bool Recontex::OptimalCoverage::analyze()
     top_sort();
     find_loops();
     find_useless_edges();
-    build_paths();
     return true;
 }
 
@@ -1257,6 +1708,42 @@ void Recontex::OptimalCoverage::find_useless_edges()
     }
 }
 
+size_t Recontex::OptimalCoverage::estimate_paths_count(size_t limit) const
+{
+    if (nodes_.empty()) {
+        return 1;
+    }
+    // Amount of paths from a node to the ends, in the DAG without loops
+    // and useless edges; saturated at `limit`.
+    std::vector<Address> order(nodes_order_.size());
+    for (auto [node, index] : nodes_order_) {
+        order[index] = node;
+    }
+    std::unordered_map<Address, size_t> counts;
+    for (auto it = order.rbegin(); it != order.rend(); ++it) {
+        Address v = *it;
+        size_t count = 0;
+        auto node = nodes_.find(v);
+        if (ends_.contains(v) || node == nodes_.end()) {
+            count = 1;
+        }
+        else {
+            for (auto const &branch : node->second.branches) {
+                Edge edge(v, branch.branch);
+                if (loops_.contains(edge) || useless_edges_.contains(edge)) {
+                    continue;
+                }
+                auto branch_count = counts.find(branch.branch);
+                count += branch_count != counts.end() ? branch_count->second
+                                                      : 1;
+                count = std::min(count, limit);
+            }
+        }
+        counts[v] = std::max<size_t>(count, 1);
+    }
+    return counts[nodes_.lower_bound(flo_.entry_point)->first];
+}
+
 void Recontex::OptimalCoverage::build_paths()
 {
     if (nodes_.empty()) {
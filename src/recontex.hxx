@@ -1,30 +1,82 @@
 #pragma once
 
+#include "contexts.hxx"
 #include "dumper.hxx"
+#include "liveness.hxx"
 #include "reflo.hxx"
 #include "struc.hxx"
 
 #include "utils/hash.hxx"
+#include "utils/pool.hxx"
 
+#include <array>
+#include <atomic>
 #include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
 #include <ostream>
+#include <span>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
 
 namespace rstc {
 
     class Recontex {
     public:
-        using FloContexts = std::multimap<Address, Context>;
+        using FloContexts = rstc::FloContexts;
+
+        enum class Engine {
+            // Replay contexts along the optimal coverage paths
+            Paths,
+            // Propagate contexts over blocks until a fixpoint,
+            // with capped joins and widening on loops
+            Dataflow,
+            // Paths, unless there are too many of them
+            Automatic,
+        };
+
+        enum class Recording {
+            // Keep contexts only at instructions read by Restruc:
+            // memory accesses, calls, jumps and cycle ends.
+            // Dead registers are canonicalized to merge contexts.
+            Demanded,
+            // Keep contexts at every instruction as they are emulated,
+            // e.g. for `debug`
+            All,
+        };
+
+        // Blocks of the paths engine which were entered with contexts
+        // already seen there, and were spliced instead of emulated
+        struct BlockMemoStats {
+            size_t hits = 0;
+            size_t misses = 0;
+        };
 
         Recontex(Reflo &reflo);
 
         void analyze();
+        // Analyzes a single flo, can be called concurrently
+        void analyze(Flo &flo);
         void set_max_analyzing_threads(size_t amount);
+        inline void set_engine(Engine engine) { engine_ = engine; }
+        inline void set_recording(Recording recording)
+        {
+            recording_ = recording;
+        }
+
+        inline BlockMemoStats const &get_block_memo_stats() const
+        {
+            return block_memo_stats_;
+        }
 
         FloContexts const &get_contexts(Flo const &flo) const;
-        std::vector<Context const *> get_contexts(Flo const &flo,
+        std::span<Context const> get_contexts(Flo const &flo,
                                                   Address address) const;
 
-        static virt::Value get_memory_address(ZydisDecodedOperand const &op,
+        static virt::Value get_memory_address(DecodedOperand const &op,
                                               Context const &context);
 
         static bool points_to_stack(ZydisRegister reg,
@@ -110,7 +162,11 @@ namespace rstc {
 
             OptimalCoverage(Flo const &flo);
 
+            // Builds nodes, loops and useless edges, but not paths
             bool analyze();
+            // Paths are built separately, as they might be too many
+            void build_paths();
+            size_t estimate_paths_count(size_t limit) const;
 
             inline std::map<Address, Node> const &nodes() { return nodes_; }
             inline std::map<Address, size_t> const &nodes_order()
@@ -128,7 +184,6 @@ namespace rstc {
             void top_sort();
             void find_loops();
             void find_useless_edges();
-            void build_paths();
 
             Flo const &flo_;
             std::unordered_set<Address> ends_;
@@ -150,9 +205,94 @@ namespace rstc {
 
         using AnalyzePaths = std::vector<AnalyzePath>;
 
+        // Contexts after the closing jump of a block
+        struct BlockResult {
+            // Of the contexts which entered the block
+            std::vector<size_t> hashes;
+            Address jump;
+            DecodedInstruction const *instruction;
+            Contexts contexts;
+        };
+
+        // Paths which made the same decisions so far,
+        // with their contexts at `address`
+        struct PathsGroup {
+            AnalyzePaths paths;
+            Contexts contexts;
+            Address address;
+        };
+
+        // Per task of the paths engine
+        struct PathsState {
+            // Block entry -> results for different entry contexts
+            std::unordered_map<Address, std::vector<BlockResult>> memo;
+            BlockMemoStats memo_stats;
+        };
+
+        // Contexts of a flo under analysis
+        struct DiscoveredFloContexts {
+            FloContexts::Discovered contexts;
+            // Instructions whose contexts are read after the analysis,
+            // contexts at other instructions are transient
+            std::unordered_set<Address> recorded;
+            bool record_all = false;
+            // Dead registers are canonicalized after each instruction
+            Liveness const *liveness = nullptr;
+
+            inline bool is_recorded(Address address) const
+            {
+                return record_all || recorded.contains(address);
+            }
+            // Empty contexts with the same settings, for another task
+            inline DiscoveredFloContexts make_fragment() const
+            {
+                DiscoveredFloContexts fragment;
+                fragment.recorded = recorded;
+                fragment.record_all = record_all;
+                fragment.liveness = liveness;
+                return fragment;
+            }
+        };
+
+        // Shared by the tasks which analyze paths of a flo,
+        // the last finished one publishes the contexts
+        struct FloAnalysis {
+            explicit FloAnalysis(Flo &flo)
+                : flo(flo)
+                , opt_cov(flo)
+            {
+            }
+            Flo &flo;
+            OptimalCoverage opt_cov;
+            std::optional<Liveness> liveness;
+            // Whether large groups of paths are spawned as tasks
+            bool spawn = false;
+            std::mutex mutex;
+            // Must outlive `flo_contexts`
+            std::vector<std::unique_ptr<utils::Pool>> pools;
+            // Settings of the tasks, and contexts merged from them
+            DiscoveredFloContexts flo_contexts;
+            BlockMemoStats memo_stats;
+            std::atomic<size_t> tasks = 0;
+        };
+
+        struct DataflowState {
+            // Block entry -> contexts to propagate
+            std::map<Address, Contexts> pending;
+            // Block entry -> hashes of contexts which entered the block
+            std::unordered_map<Address, std::unordered_set<size_t>> entered;
+            std::unordered_set<Address> leaders;
+            // Jump -> node, see `OptimalCoverage::loops`
+            OptimalCoverage::Edges loop_edges;
+            std::unordered_map<OptimalCoverage::Edge,
+                               size_t,
+                               OptimalCoverage::EdgeHash>
+                loop_passes;
+        };
+
         struct PropagationResult {
             Contexts new_contexts;
-            ZydisDecodedInstruction const *instruction = nullptr;
+            DecodedInstruction const *instruction = nullptr;
         };
 
         struct Operand {
@@ -161,21 +301,79 @@ namespace rstc {
             ZydisRegister reg = ZYDIS_REGISTER_NONE;
         };
 
-        using EmulationCallback =
-            std::function<virt::Value(virt::Value const &dst,
-                                      virt::Value const &src)>;
-        using EmulationCallbackAction =
-            std::function<uintptr_t(uintptr_t, uintptr_t)>;
+        // Instructions are emulated by handlers specialized
+        // for the mnemonic and the shape of its operands
+        enum EmulationKind : uint8_t {
+            EMULATION_KIND_DEFAULT,
+            EMULATION_KIND_MOV,
+            EMULATION_KIND_ADD,
+            EMULATION_KIND_SUB,
+            EMULATION_KIND_OR,
+            EMULATION_KIND_AND,
+            EMULATION_KIND_XOR,
+            EMULATION_KIND_IMUL,
+            EMULATION_KIND_LEA,
+            EMULATION_KIND_PUSH,
+            EMULATION_KIND_POP,
+            EMULATION_KIND_CALL,
+            EMULATION_KIND_RET,
+            EMULATION_KIND_INC,
+            EMULATION_KIND_DEC,
+
+            EMULATION_KINDS_COUNT,
+        };
 
-        void run_analysis(Flo &flo);
-        void wait_for_analysis();
+        // Destination and source of two explicit operands
+        enum OperandShape {
+            OPERAND_SHAPE_REG_REG,
+            OPERAND_SHAPE_REG_IMM,
+            OPERAND_SHAPE_REG_MEM,
+            OPERAND_SHAPE_MEM_REG,
+            OPERAND_SHAPE_MEM_IMM,
+            OPERAND_SHAPE_GENERIC,
 
-        void analyze_flo(Flo &flo,
-                         FloContexts &flo_contexts,
-                         AnalyzePaths paths,
-                         Contexts contexts,
-                         Address address);
+            OPERAND_SHAPES_COUNT,
+        };
 
+        using EmulationHandler = void (*)(DecodedInstruction const &instruction,
+                                          Context &context,
+                                          Address address);
+        using EmulationHandlers =
+            std::array<EmulationHandler, OPERAND_SHAPES_COUNT>;
+
+        void run_analysis(Flo &flo, bool spawn);
+        void publish_contexts(FloAnalysis &analysis);
+
+        void analyze_flo(std::shared_ptr<FloAnalysis> const &analysis,
+                         PathsGroup group);
+        void analyze_paths_group(Flo &flo,
+                                 DiscoveredFloContexts &flo_contexts,
+                                 PathsState &state,
+                                 PathsGroup group,
+                                 std::vector<PathsGroup> &groups);
+        void spawn_paths_group(std::shared_ptr<FloAnalysis> const &analysis,
+                               PathsGroup group);
+
+        void analyze_flo_dataflow(Flo &flo,
+                                  DiscoveredFloContexts &flo_contexts,
+                                  OptimalCoverage &opt_cov,
+                                  Contexts contexts);
+        void analyze_block(Flo &flo,
+                           DiscoveredFloContexts &flo_contexts,
+                           OptimalCoverage &opt_cov,
+                           DataflowState &state,
+                           Address address,
+                           Contexts contexts);
+        void flow_contexts(OptimalCoverage &opt_cov,
+                           DataflowState &state,
+                           Address src,
+                           Address dst,
+                           Contexts contexts);
+
+        static BlockResult const *
+        find_block_result(PathsState const &state,
+                          Address block,
+                          std::vector<size_t> const &hashes);
         static AnalyzePaths
         optimal_paths_to_analyze_paths(OptimalCoverage::Paths const &paths);
         static AnalyzePaths split_analyze_paths(AnalyzePaths &paths);
@@ -183,49 +381,74 @@ namespace rstc {
         static bool same_analyze_path(AnalyzePaths const &paths);
 
         PropagationResult propagate_contexts(Flo const &flo,
-                                             FloContexts &flo_contexts,
+                                             DiscoveredFloContexts &flo_contexts,
                                              Address address,
                                              Contexts contexts);
-        Context const &emplace_context(FloContexts &flo_contexts,
+        static void canonicalize_registers(Context &context,
+                                           Liveness::Registers registers);
+        Context const &emplace_context(DiscoveredFloContexts &flo_contexts,
                                        Address address,
                                        Context &&context);
         void emulate(Address address,
-                     ZydisDecodedInstruction const &instruction,
+                     DecodedInstruction const &instruction,
                      Context &context);
-        void emulate_instruction(ZydisDecodedInstruction const &instruction,
-                                 Context &context,
-                                 Address address,
-                                 EmulationCallback const &callback);
-        void emulate_instruction_lea(ZydisDecodedInstruction const &instruction,
-                                     Context &context,
-                                     Address address);
-        void
-        emulate_instruction_push(ZydisDecodedInstruction const &instruction,
+        static void emulate_default(DecodedInstruction const &instruction,
+                                    Context &context,
+                                    Address address);
+        template<typename Operation,
+                 ZydisOperandType DstType,
+                 ZydisOperandType SrcType>
+        static void emulate_instruction(DecodedInstruction const &instruction,
+                                        Context &context,
+                                        Address address);
+        template<typename Operation>
+        static void emulate_instruction(DecodedInstruction const &instruction,
+                                        Context &context,
+                                        Address address);
+        static void
+        emulate_instruction_lea(DecodedInstruction const &instruction,
+                                Context &context,
+                                Address address);
+        static void
+        emulate_instruction_push(DecodedInstruction const &instruction,
                                  Context &context,
                                  Address address);
-        void emulate_instruction_pop(ZydisDecodedInstruction const &instruction,
-                                     Context &context,
-                                     Address address);
-        void
-        emulate_instruction_call(ZydisDecodedInstruction const &instruction,
+        static void
+        emulate_instruction_pop(DecodedInstruction const &instruction,
+                                Context &context,
+                                Address address);
+        static void
+        emulate_instruction_call(DecodedInstruction const &instruction,
                                  Context &context,
                                  Address address);
-        void emulate_instruction_ret(ZydisDecodedInstruction const &instruction,
-                                     Context &context,
-                                     Address address);
-        void emulate_instruction_inc(ZydisDecodedInstruction const &instruction,
-                                     Context &context,
-                                     Address address,
-                                     int offset);
-        static virt::Value emulate_instruction_helper(
-            virt::Value const &dst,
-            virt::Value const &src,
-            std::function<uintptr_t(uintptr_t, uintptr_t)> action);
-        static Operand get_operand(ZydisDecodedOperand const &operand,
+        static void
+        emulate_instruction_ret(DecodedInstruction const &instruction,
+                                Context &context,
+                                Address address);
+        template<int offset>
+        static void
+        emulate_instruction_inc(DecodedInstruction const &instruction,
+                                Context &context,
+                                Address address);
+        static OperandShape
+        get_operand_shape(DecodedInstruction const &instruction);
+        template<typename Operation>
+        static constexpr EmulationHandlers make_emulation_handlers();
+        static constexpr EmulationHandlers
+        make_emulation_handlers(EmulationHandler handler);
+        static Operand get_operand(DecodedOperand const &operand,
+                                   Context const &context,
+                                   Address source);
+        template<ZydisOperandType Type>
+        static Operand get_operand(DecodedOperand const &operand,
                                    Context const &context,
                                    Address source);
+        static void set_operand(Context &context, Operand const &operand);
 
-        Contexts make_flo_initial_contexts(Flo &flo);
+        Contexts make_flo_initial_contexts(Flo &flo, utils::Pool &pool);
+        void find_recorded_instructions(Flo const &flo,
+                                        OptimalCoverage &opt_cov,
+                                        DiscoveredFloContexts &flo_contexts);
 
         template<typename CS>
         static Contexts make_child_contexts(CS const &parents)
@@ -240,13 +463,13 @@ namespace rstc {
         }
 
         static bool
-        instruction_has_memory_access(ZydisDecodedInstruction const &instr);
-        static bool operand_has_memory_access(ZydisDecodedOperand const &op);
+        instruction_has_memory_access(DecodedInstruction const &instr);
+        static bool operand_has_memory_access(DecodedOperand const &op);
         static bool instruction_has_nonstack_memory_access(
-            ZydisDecodedInstruction const &instr);
+            DecodedInstruction const &instr);
         static bool
-        operand_has_nonstack_memory_access(ZydisDecodedOperand const &op);
-        static bool is_history_term_instr(ZydisDecodedInstruction const &instr);
+        operand_has_nonstack_memory_access(DecodedOperand const &op);
+        static bool is_history_term_instr(DecodedInstruction const &instr);
 
         void dump_register_history(std::ostream &os,
                                    Dumper const &dumper,
@@ -256,35 +479,45 @@ namespace rstc {
         void dump_memory_history(std::ostream &os,
                                  Dumper const &dumper,
                                  Context const &context,
-                                 ZydisDecodedOperand const &op,
+                                 DecodedOperand const &op,
                                  std::unordered_set<Address> &visited) const;
         void dump_instruction_history(
             std::ostream &os,
             Dumper const &dumper,
             Address address,
-            ZydisDecodedInstruction const &instr,
-            std::vector<Context const *> const &contexts,
+            DecodedInstruction const &instr,
+            std::span<Context const> contexts,
             std::unordered_set<Address> visited = {}) const;
 
         Reflo &reflo_;
         PE const &pe_;
 
-        std::mutex modify_access_contexts_mutex_;
+        mutable std::mutex modify_access_contexts_mutex_;
+        // Must outlive `contexts_`
+        std::map<Address, std::vector<std::unique_ptr<utils::Pool>>> pools_;
         std::map<Address, FloContexts> contexts_;
 
-        size_t max_analyzing_threads_;
-        std::atomic<size_t> analyzing_threads_count_ = 0;
-        std::vector<std::thread> analyzing_threads_;
-        std::mutex analyzing_threads_mutex_;
-        std::condition_variable analyzing_threads_cv_;
+        std::shared_ptr<Executor> executor_;
+
+        Engine engine_ = Engine::Automatic;
+        Recording recording_ = Recording::Demanded;
+        BlockMemoStats block_memo_stats_;
 
+        static size_t const max_paths_count_ = 4096;
+        static size_t const max_block_contexts_ = 64;
+        static size_t const max_loop_passes_ = 1;
+        static size_t const min_spawned_paths_ = 64;
         static uintptr_t const magic_stack_value_ = 0xFFF4B1D1;
+        // Symbol of registers which are dead
+        static uintptr_t const dead_register_id_ = 0xDEADDEADDEADDE;
         static uintptr_t const magic_stack_value_mask_ =
             (magic_stack_value_ & ~1) << 32;
         static ZydisRegister const nonvolatile_registers_[];
         static ZydisRegister const volatile_registers_[];
-        static std::unordered_map<ZydisMnemonic, EmulationCallbackAction>
-            emulation_callback_actions_;
+        static std::array<EmulationHandlers, EMULATION_KINDS_COUNT> const
+            emulation_handlers_;
+        static std::array<EmulationKind, ZYDIS_MNEMONIC_MAX_VALUE + 1> const
+            emulation_kinds_;
     };
 
 }
@@ -1,7 +1,6 @@
 #include "reflo.hxx"
 
 #include "dumper.hxx"
-#include "scope_guard.hxx"
 #include "zyan_error.hxx"
 
 #include <cinttypes>
@@ -20,7 +19,7 @@ using namespace rstc;
 
 Reflo::Reflo(std::filesystem::path const &pe_path)
     : pe_(pe_path)
-    , max_analyzing_threads_(std::thread::hardware_concurrency())
+    , executor_(std::make_shared<Executor>())
 {
     ZYAN_THROW(ZydisDecoderInit(&decoder_,
                                 ZYDIS_MACHINE_MODE_LONG_64,
@@ -62,14 +61,39 @@ std::pair<DWORD, DWORD> Reflo::get_analyzed_va_bounds() const
              pe_.raw_to_virtual_address(last) };
 }
 
-Instruction Reflo::decode_instruction(Address address, Address end)
+ZydisDecodedInstruction Reflo::decode_instruction(Address address,
+                                                  Address end) const
 {
-    Instruction instruction = std::make_unique<ZydisDecodedInstruction>();
+    ZydisDecodedInstruction instruction;
     ZYAN_THROW(ZydisDecoderDecodeBuffer(&decoder_,
                                         address,
                                         end - address,
-                                        instruction.get()));
-    return std::move(instruction);
+                                        &instruction));
+    return instruction;
+}
+
+Flo::AnalysisResult
+Reflo::analyze_instruction(Flo &flo, Address address, Address end) const
+{
+    if (decode_cache_) {
+        // Cached instruction might cross the flo end
+        if (auto instruction = decode_cache_->find(address);
+            instruction && instruction->length <= end - address) {
+#if defined(DEBUG_ANALYSIS) || defined(DEBUG_POST_ANALYSIS)
+            Dumper dumper;
+            DWORD va = pe_.raw_to_virtual_address(address);
+            dumper.dump_instruction(std::clog, va, *instruction);
+#endif
+            return flo.analyze(address, instruction);
+        }
+    }
+    auto instruction = decode_instruction(address, end);
+#if defined(DEBUG_ANALYSIS) || defined(DEBUG_POST_ANALYSIS)
+    Dumper dumper;
+    DWORD va = pe_.raw_to_virtual_address(address);
+    dumper.dump_instruction(std::clog, va, instruction);
+#endif
+    return flo.analyze(address, instruction);
 }
 
 void Reflo::fill_flo(Flo &flo)
@@ -83,13 +107,7 @@ void Reflo::fill_flo(Flo &flo)
         end = pe_.get_end(address);
     }
     while (address && address < end) {
-        auto instruction = decode_instruction(address, end);
-#ifdef DEBUG_ANALYSIS
-        Dumper dumper;
-        DWORD va = pe_.raw_to_virtual_address(address);
-        dumper.dump_instruction(std::clog, va, *instruction);
-#endif
-        auto analysis_result = flo.analyze(address, std::move(instruction));
+        auto analysis_result = analyze_instruction(flo, address, end);
         if (analysis_result.status == Flo::Stop) {
             break;
         }
@@ -114,13 +132,7 @@ void Reflo::post_fill_flo(Flo &flo)
             end = pe_.get_end(address);
         }
         while (address && address < end) {
-            auto instruction = decode_instruction(address, end);
-#ifdef DEBUG_POST_ANALYSIS
-            Dumper dumper;
-            DWORD va = pe_.raw_to_virtual_address(address);
-            dumper.dump_instruction(std::clog, va, *instruction);
-#endif
-            auto analysis_result = flo.analyze(address, std::move(instruction));
+            auto analysis_result = analyze_instruction(flo, address, end);
             if (analysis_result.status == Flo::Stop) {
                 break;
             }
@@ -131,7 +143,7 @@ void Reflo::post_fill_flo(Flo &flo)
 
 void Reflo::trim_flo(Flo &flo)
 {
-    auto last = flo.get_disassembly().rbegin();
+    auto last = flo.get_discovered_disassembly().rbegin();
     auto it = last;
     while (is_inter_flo_filler(
         it->second->mnemonic) /* && !is_tail_mnemonic(it->second->mnemonic)*/) {
@@ -216,44 +228,23 @@ std::vector<Address> Reflo::get_possible_flo_ends(Address entry_point) const
     return possible_ends;
 }
 
-void Reflo::wait_before_analysis_run()
+bool Reflo::run_flo_analysis(Address entry_point, Address reference)
 {
-    auto lock = std::unique_lock(flos_waiting_mutex_);
-    flos_cv_.wait(lock, [this] {
-        return analyzing_threads_count_ < max_analyzing_threads_;
-    });
-    ++analyzing_threads_count_;
-}
-
-void Reflo::run_flo_analysis(Address entry_point, Address reference)
-{
-    // Prevent recursive and duplicate analysis
-    if (created_flos_.contains(entry_point)) {
-        {
-            // Wait for flo to be created
-            auto lock = std::unique_lock(flos_waiting_mutex_);
-            flos_cv_.wait(lock, [this, entry_point] {
-                std::scoped_lock<std::mutex> flo_guard(flos_mutex_);
-                return flos_.contains(entry_point);
-            });
-        }
-        auto &flo = *flos_.at(entry_point);
-        {
-            std::scoped_lock<std::mutex> add_reference_guard(flo.mutex());
-            flo.add_reference(reference);
+    {
+        std::scoped_lock<std::mutex> created_flos_guard(flos_mutex_);
+        // Prevent recursive and duplicate analysis
+        if (auto [_, inserted] = created_flos_.emplace(entry_point);
+            !inserted) {
+            // Flo might be still under analysis,
+            // add the reference once analysis is finished.
+            if (reference) {
+                deferred_references_.emplace_back(entry_point, reference);
+            }
+            return false;
         }
-        return;
     }
-    created_flos_.emplace(entry_point);
-    wait_before_analysis_run();
-    analyzing_threads_.emplace_back([this, entry_point, reference]() mutable {
+    executor_->submit([this, entry_point, reference] {
         try {
-            ScopeGuard decrement_analyzing_threads_count([this]() noexcept {
-                std::scoped_lock<std::mutex> notify_guard(flos_waiting_mutex_);
-                --analyzing_threads_count_;
-                flos_cv_.notify_all();
-            });
-
 #ifdef DEBUG_ANALYSIS
             std::clog << "Analyzing: " << std::hex << std::setfill('0')
                       << std::setw(8) << pe_.raw_to_virtual_address(entry_point)
@@ -264,12 +255,30 @@ void Reflo::run_flo_analysis(Address entry_point, Address reference)
             if (!possible_ends.empty()) {
                 end = possible_ends.back();
             }
-            auto flo = std::make_unique<Flo>(pe_, entry_point, reference, end);
-            fill_flo(*flo);
+            auto new_flo =
+                std::make_unique<Flo>(pe_, entry_point, reference, end);
+            fill_flo(*new_flo);
             if (possible_ends.size() > 1) {
-                assert(!can_split_flo(*flo, possible_ends));
+                assert(!can_split_flo(*new_flo, possible_ends));
+            }
+            auto &flo = add_flo(std::move(new_flo));
+
+            // Iterate over ~~unique~~ all call destinations
+            // All, because we collect references
+            for (auto const &[_, call] : flo.get_calls()) {
+                run_flo_analysis(call.dst, call.src);
+            }
+
+            // Iterate over ~~unique~~ all outer jumps
+            // All, because we collect references
+            for (auto const &[_, jump] : flo.get_outer_jumps()) {
+                run_flo_analysis(jump.dst, jump.src);
+            }
+
+            // Flo without unknown jumps won't be changed by post analysis
+            if (publish_callback_ && flo.get_unknown_jumps().empty()) {
+                publish_flo(flo);
             }
-            add_flo(std::move(flo));
         }
         catch (zyan_error const &e) {
             std::cerr << std::hex << std::setfill('0')
@@ -278,28 +287,25 @@ void Reflo::run_flo_analysis(Address entry_point, Address reference)
                       << e.what() << '\n';
         }
     });
+    return true;
 }
 
-void Reflo::add_flo(std::unique_ptr<Flo> &&flo)
+Flo &Reflo::add_flo(std::unique_ptr<Flo> &&flo)
 {
     auto entry_point = flo->entry_point;
-    std::scoped_lock<std::mutex, std::mutex> adding_flo_guard(
-        flos_mutex_,
-        unprocessed_flos_mutex_);
-    flos_.emplace(entry_point, std::move(flo));
-    unprocessed_flos_.push_back(entry_point);
+    std::scoped_lock<std::mutex> adding_flo_guard(flos_mutex_);
+    auto [it, inserted] = flos_.emplace(entry_point, std::move(flo));
+    assert(inserted);
+    if (!it->second->get_unknown_jumps().empty()) {
+        pending_flos_.push_back(it->second.get());
+    }
+    return *it->second;
 }
 
 void Reflo::run_flo_post_analysis(Flo &flo)
 {
-    wait_before_analysis_run();
-    analyzing_threads_.emplace_back([&] {
+    executor_->submit([this, &flo] {
         try {
-            ScopeGuard decrement_analyzing_threads_count([this]() noexcept {
-                std::scoped_lock<std::mutex> notify_guard(flos_waiting_mutex_);
-                --analyzing_threads_count_;
-                flos_cv_.notify_all();
-            });
             // Post fill/analysis cannot happen for functions with defined
             // boundaries, which can be found in RUNTIME_FUNCTION.
             assert(!pe_.get_runtime_function(
@@ -316,52 +322,88 @@ void Reflo::run_flo_post_analysis(Flo &flo)
     });
 }
 
-Address Reflo::pop_unprocessed_flo()
+void Reflo::find_and_analyze_flos()
 {
-    std::scoped_lock<std::mutex> popping_flo_guard(unprocessed_flos_mutex_);
-    auto address = unprocessed_flos_.front();
-    unprocessed_flos_.pop_front();
-    return address;
+    discovery_stats_ = DiscoveryStats();
+    Seeds seeds;
+    add_seed(seeds, pe_.get_entry_point(), &DiscoveryStats::entry_point);
+    if (discovery_ == Discovery::Seeded) {
+        seed_flos(seeds);
+    }
+    wait_for_analysis();
+    // Counted once every flo is analyzed, so that seeds reached from the
+    // entry point meanwhile still count as seeds. Flos which failed
+    // analysis aren't counted.
+    for (auto const &[entry_point, flo] : flos_) {
+        if (auto it = seeds.find(entry_point); it != seeds.end()) {
+            ++(discovery_stats_.*it->second);
+        }
+        else {
+            ++discovery_stats_.discovered;
+        }
+    }
 }
 
-void Reflo::find_and_analyze_flos()
+void Reflo::seed_flos(Seeds &seeds)
 {
-    run_flo_analysis(pe_.get_entry_point(), nullptr);
-    while (true) {
-        if (unprocessed_flos_.empty()) {
-            // Wait for all analyzing threads
-            auto lock = std::unique_lock(flos_waiting_mutex_);
-            flos_cv_.wait(lock, [this] {
-                return analyzing_threads_count_ == 0
-                       || !unprocessed_flos_.empty();
-            });
-        }
-        if (analyzing_threads_count_ == 0 && unprocessed_flos_.empty()) {
-            break;
+    // Workers are already busy with the entry point,
+    // seeds are picked up as soon as they are submitted.
+    for (auto va : pe_.tls_callbacks()) {
+        seed_flo(seeds, va, &DiscoveryStats::tls_callbacks);
+    }
+    for (auto va : pe_.exported_functions()) {
+        seed_flo(seeds, va, &DiscoveryStats::exports);
+    }
+    RUNTIME_FUNCTION const *previous = nullptr;
+    for (auto const &runtime_function : pe_.runtime_functions()) {
+        if (is_flo_seed(runtime_function, previous)) {
+            seed_flo(seeds,
+                     runtime_function.BeginAddress,
+                     &DiscoveryStats::runtime_functions);
         }
+        previous = &runtime_function;
+    }
+}
 
-        auto &flo = flos_[pop_unprocessed_flo()];
+void Reflo::seed_flo(Seeds &seeds, DWORD va, size_t DiscoveryStats::*counter)
+{
+    // Exports might point to data
+    if (!pe_.is_executable(va)) {
+        return;
+    }
+    if (auto address = pe_.virtual_to_raw_address(va); address) {
+        add_seed(seeds, address, counter);
+    }
+}
 
-        // Iterate over ~~unique~~ all call destinations
-        // All, because we collect references
-        for (auto it = flo->get_calls().begin(), end = flo->get_calls().end();
-             it != end;
-             ++it) {
-            auto const &call = it->second;
-            run_flo_analysis(call.dst, call.src);
-        }
+void Reflo::add_seed(Seeds &seeds,
+                     Address address,
+                     size_t DiscoveryStats::*counter)
+{
+    // A flo seeded from several sources counts for the first one
+    seeds.emplace(address, counter);
+    run_flo_analysis(address, nullptr);
+}
 
-        // Iterate over ~~unique~~ all outer jumps
-        // All, because we collect references
-        for (auto it = flo->get_outer_jumps().begin(),
-                  end = flo->get_outer_jumps().end();
-             it != end;
-             ++it) {
-            auto const &jump = it->second;
-            run_flo_analysis(jump.dst, jump.src);
-        }
+bool Reflo::is_flo_seed(RUNTIME_FUNCTION const &runtime_function,
+                        RUNTIME_FUNCTION const *previous) const
+{
+    // Contiguous RUNTIME_FUNCTION is a part of the previous flo,
+    // see `get_possible_flo_ends`.
+    if (previous && previous->EndAddress == runtime_function.BeginAddress) {
+        return false;
     }
-    wait_for_analysis();
+    // Unwind data pointing to another RUNTIME_FUNCTION
+    if (runtime_function.UnwindData & 1) {
+        return false;
+    }
+    // Chained unwind info describes a fragment of another function
+    if (auto unwind_info =
+            pe_.virtual_to_raw_address(runtime_function.UnwindData);
+        unwind_info && ((*unwind_info >> 3) & UNW_FLAG_CHAININFO)) {
+        return false;
+    }
+    return true;
 }
 
 void Reflo::promote_jumps_to_outer()
@@ -370,7 +412,7 @@ void Reflo::promote_jumps_to_outer()
     // Because we have all flos, and we can assume that all
     // unknown jumps from a flos is "outer"
     // if dst is in list of existing flos_.
-    for (auto const &[entry_point, flo] : flos_) {
+    for (auto flo : pending_flos_) {
         flo->promote_unknown_jumps(Jump::Outer, [this](Address dst) mutable {
             return flos_.contains(dst);
         });
@@ -382,26 +424,36 @@ void Reflo::promote_jumps_to_inner()
     // Promote all unknown jumps to inner jumps,
     // as some unknown jumps were promoted to outer jumps,
     // the remaining jumps should be inner jumps.
-    for (auto const &[entry_point, flo] : flos_) {
+    for (auto flo : pending_flos_) {
         bool needs_post_analysis = !flo->get_unknown_jumps().empty();
         flo->promote_unknown_jumps(Jump::Inner);
         if (needs_post_analysis) {
-            unprocessed_flos_.push_back(entry_point);
+            unprocessed_flos_.push_back(flo);
         }
     }
+    pending_flos_.clear();
 }
 
 void Reflo::post_analyze_flos()
 {
-    while (!unprocessed_flos_.empty()) {
-        auto &flo = flos_[pop_unprocessed_flo()];
+    for (auto flo : unprocessed_flos_) {
         run_flo_post_analysis(*flo);
     }
     wait_for_analysis();
+    // Only post analyzed flos might get new unknown jumps
+    for (auto flo : unprocessed_flos_) {
+        if (!flo->get_unknown_jumps().empty()) {
+            pending_flos_.push_back(flo);
+        }
+    }
+    unprocessed_flos_.clear();
 }
 
 void Reflo::analyze()
 {
+    if (predecode_) {
+        decode_cache_ = std::make_unique<DecodeCache>(pe_, *executor_);
+    }
     find_and_analyze_flos();
     while (unknown_jumps_exist()) {
         promote_jumps_to_outer();
@@ -411,21 +463,43 @@ void Reflo::analyze()
         promote_jumps_to_inner();
         post_analyze_flos();
     }
+    // Flos own copies of the instructions they use
+    decode_cache_.reset();
+    freeze_flos();
+}
+
+void Reflo::freeze_flos()
+{
+    for (auto const &[_, flo] : flos_) {
+        if (!flo->is_frozen()) {
+            executor_->submit([this, &flo = *flo] { publish_flo(flo); });
+        }
+    }
+    executor_->wait();
+}
+
+void Reflo::publish_flo(Flo &flo)
+{
+    flo.freeze();
+    if (publish_callback_) {
+        publish_callback_(flo);
+    }
 }
 
 void Reflo::wait_for_analysis()
 {
-    std::for_each(analyzing_threads_.begin(),
-                  analyzing_threads_.end(),
-                  [](std::thread &t) { t.join(); });
-    analyzing_threads_.clear();
+    executor_->wait();
+    for (auto [entry_point, reference] : deferred_references_) {
+        if (auto it = flos_.find(entry_point); it != flos_.end()) {
+            it->second->add_reference(reference);
+        }
+    }
+    deferred_references_.clear();
 }
 
 bool Reflo::unknown_jumps_exist() const
 {
-    return std::any_of(flos_.cbegin(), flos_.cend(), [](auto const &flo) {
-        return !flo.second->get_unknown_jumps().empty();
-    });
+    return !pending_flos_.empty();
 }
 
 bool Reflo::is_tail_mnemonic(ZydisMnemonic mnemonic)
@@ -452,7 +526,7 @@ bool Reflo::is_inter_flo_filler(ZydisMnemonic mnemonic)
 
 void Reflo::set_max_analyzing_threads(size_t amount)
 {
-    max_analyzing_threads_ = amount;
+    executor_->set_workers_count(amount);
 }
 
 void Reflo::debug(std::ostream &os, DWORD va)
@@ -468,6 +542,7 @@ void Reflo::debug(std::ostream &os, DWORD va)
         promote_jumps_to_inner();
         post_analyze_flos();
     }
+    freeze_flos();
     for (auto const &[addr, flo] : flos_) {
         dumper.dump_flo(os, *flo, pe_.raw_to_virtual_address(flo->entry_point));
     }
@@ -1,27 +1,64 @@
 #pragma once
 
+#include "decode_cache.hxx"
+#include "executor.hxx"
 #include "flo.hxx"
 #include "pe.hxx"
 
 #include <Zydis/Zydis.h>
 
-#include <atomic>
-#include <deque>
+#include <functional>
 #include <map>
 #include <memory>
 #include <mutex>
 #include <set>
-#include <thread>
+#include <unordered_map>
 #include <unordered_set>
+#include <vector>
 
 namespace rstc {
 
     class Reflo {
     public:
+        enum class Discovery {
+            // Start from the entry point, follow calls and jumps
+            EntryPoint,
+            // Additionally start from every RUNTIME_FUNCTION,
+            // export and TLS callback
+            Seeded,
+        };
+
+        // Amount of flos created from each source
+        struct DiscoveryStats {
+            size_t entry_point = 0;
+            size_t runtime_functions = 0;
+            size_t exports = 0;
+            size_t tls_callbacks = 0;
+            size_t discovered = 0;
+        };
+
+        // Called from a worker for every flo, once it cannot change anymore
+        using PublishCallback = std::function<void(Flo &)>;
+
         Reflo(std::filesystem::path const &pe_path);
 
         void analyze();
         void set_max_analyzing_threads(size_t amount);
+        inline void set_discovery(Discovery discovery)
+        {
+            discovery_ = discovery;
+        }
+        // Decode executable sections ahead of the discovery
+        inline void set_predecode(bool predecode) { predecode_ = predecode; }
+        inline void set_publish_callback(PublishCallback callback)
+        {
+            publish_callback_ = std::move(callback);
+        }
+
+        inline DiscoveryStats const &get_discovery_stats() const
+        {
+            return discovery_stats_;
+        }
 
         void debug(std::ostream &os, DWORD va);
 
@@ -37,46 +74,70 @@ namespace rstc {
         }
 
         inline PE const &get_pe() const { return pe_; }
+        inline std::shared_ptr<Executor> const &get_executor() const
+        {
+            return executor_;
+        }
 
     private:
-        Instruction decode_instruction(Address address, Address end);
+        ZydisDecodedInstruction decode_instruction(Address address,
+                                                   Address end) const;
 
+        Flo::AnalysisResult
+        analyze_instruction(Flo &flo, Address address, Address end) const;
         void fill_flo(Flo &flo);
         void post_fill_flo(Flo &flo);
         void trim_flo(Flo &flo);
         bool can_split_flo(Flo &flo,
                            std::vector<Address> const &possible_splits) const;
         std::vector<Address> get_possible_flo_ends(Address entry_point) const;
-        void wait_before_analysis_run();
-        void run_flo_analysis(Address entry_point, Address reference);
-        void add_flo(std::unique_ptr<Flo> &&flo);
+        bool run_flo_analysis(Address entry_point, Address reference);
+        Flo &add_flo(std::unique_ptr<Flo> &&flo);
         void run_flo_post_analysis(Flo &flo);
+        // Entry point of a seed -> counter of its source
+        using Seeds = std::unordered_map<Address, size_t DiscoveryStats::*>;
+
         void find_and_analyze_flos();
+        void seed_flos(Seeds &seeds);
+        void seed_flo(Seeds &seeds, DWORD va, size_t DiscoveryStats::*counter);
+        void add_seed(Seeds &seeds,
+                      Address address,
+                      size_t DiscoveryStats::*counter);
+        bool is_flo_seed(RUNTIME_FUNCTION const &runtime_function,
+                         RUNTIME_FUNCTION const *previous) const;
         void promote_jumps_to_outer();
         void promote_jumps_to_inner();
         void post_analyze_flos();
+        void freeze_flos();
+        void publish_flo(Flo &flo);
         void wait_for_analysis();
         bool unknown_jumps_exist() const;
 
         static bool is_tail_mnemonic(ZydisMnemonic mnemonic);
         static bool is_inter_flo_filler(ZydisMnemonic mnemonic);
 
-        Address pop_unprocessed_flo();
-
         ZydisDecoder decoder_;
 
         PE pe_;
 
-        size_t max_analyzing_threads_;
-        std::atomic<size_t> analyzing_threads_count_ = 0;
+        Discovery discovery_ = Discovery::EntryPoint;
+        DiscoveryStats discovery_stats_;
+
+        bool predecode_ = false;
+        std::unique_ptr<DecodeCache> decode_cache_;
+
+        PublishCallback publish_callback_;
+
+        std::shared_ptr<Executor> executor_;
         std::mutex flos_mutex_;
-        std::mutex flos_waiting_mutex_;
-        std::mutex unprocessed_flos_mutex_;
-        std::condition_variable flos_cv_;
-        std::vector<std::thread> analyzing_threads_;
         std::unordered_set<Address> created_flos_;
+        // Entry point -> reference, for flos which were already created
+        std::vector<std::pair<Address, Address>> deferred_references_;
         std::map<Address, std::unique_ptr<Flo>> flos_;
-        std::deque<Address> unprocessed_flos_;
+        // Flos with unknown jumps
+        std::vector<Flo *> pending_flos_;
+        // Flos which need post analysis
+        std::vector<Flo *> unprocessed_flos_;
     };
 
 }
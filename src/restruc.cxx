@@ -1,14 +1,19 @@
 #include "restruc.hxx"
 
 #include "dumper.hxx"
-#include "scope_guard.hxx"
 #include "struc.hxx"
 #include "utils/adapters.hxx"
 #include "utils/hash.hxx"
 
+#include <algorithm>
 #include <iomanip>
 #include <iostream>
+#include <map>
+#include <numeric>
 #include <sstream>
+#include <tuple>
+#include <unordered_map>
+#include <vector>
 
 using namespace rstc;
 
@@ -17,11 +22,121 @@ using namespace rstc;
 //#define DEBUG_INTER_LINK
 //#define DEBUG_MERGE
 
+namespace {
+
+    // Union-find over strucs. Strucs of a class are merged, so strucs
+    // which they point to at the same offset are united as well.
+    // Pointer fields of a struc only count once it is united with another
+    // struc, the same way pointees of merged strucs used to be merged.
+    class StrucClasses {
+    public:
+        // Offset -> struc, which a struc points to
+        using Pointers = std::vector<std::pair<size_t, size_t>>;
+
+        explicit StrucClasses(std::vector<Pointers> pointers)
+            : parents_(pointers.size())
+            , sizes_(pointers.size(), 1)
+            , targets_(pointers.size())
+            , pointers_(std::move(pointers))
+        {
+            std::iota(parents_.begin(), parents_.end(), 0);
+        }
+
+        size_t find(size_t struc)
+        {
+            while (parents_[struc] != struc) {
+                parents_[struc] = parents_[parents_[struc]];
+                struc = parents_[struc];
+            }
+            return struc;
+        }
+
+        // Class of `struc` points to `target` at `offset`
+        void add_target(size_t struc, size_t offset, size_t target)
+        {
+            auto &targets = targets_[find(struc)];
+            if (auto [it, inserted] = targets.emplace(offset, target);
+                !inserted) {
+                unite(it->second, target);
+            }
+        }
+
+        void unite(size_t a, size_t b)
+        {
+            std::vector<std::pair<size_t, size_t>> pending{ { a, b } };
+            while (!pending.empty()) {
+                auto [x, y] = pending.back();
+                pending.pop_back();
+                x = find(x);
+                y = find(y);
+                if (x == y) {
+                    continue;
+                }
+                add_pointers(x, pending);
+                add_pointers(y, pending);
+                if (sizes_[x] < sizes_[y]) {
+                    std::swap(x, y);
+                }
+                parents_[y] = x;
+                sizes_[x] += sizes_[y];
+                for (auto [offset, target] : targets_[y]) {
+                    if (auto [it, inserted] =
+                            targets_[x].emplace(offset, target);
+                        !inserted) {
+                        pending.emplace_back(it->second, target);
+                    }
+                }
+                targets_[y].clear();
+            }
+        }
+
+    private:
+        // Only a struc which was never united has pointers left
+        void add_pointers(size_t root,
+                          std::vector<std::pair<size_t, size_t>> &pending)
+        {
+            for (auto [offset, target] : pointers_[root]) {
+                if (auto [it, inserted] =
+                        targets_[root].emplace(offset, target);
+                    !inserted) {
+                    pending.emplace_back(it->second, target);
+                }
+            }
+            pointers_[root].clear();
+        }
+
+        std::vector<size_t> parents_;
+        std::vector<size_t> sizes_;
+        // Offset -> struc, which a class points to
+        std::vector<std::map<size_t, size_t>> targets_;
+        std::vector<Pointers> pointers_;
+    };
+
+    // Pointer field which covers `offset`, like the one a linked child
+    // is loaded from. Returns `offset` and no struc if there is none.
+    std::pair<size_t, Struc const *>
+    get_pointer_field(Struc const &struc, size_t offset)
+    {
+        std::pair<size_t, Struc const *> pointer(offset, nullptr);
+        struc.visit_fields_at(offset, [&](size_t field_offset,
+                                          Struc::Field const &field) {
+            if (field.type() == Struc::Field::Pointer && field.struc()
+                && field_offset % 8 == offset % 8) {
+                pointer = { field_offset, field.struc() };
+                return true;
+            }
+            return false;
+        });
+        return pointer;
+    }
+
+}
+
 Restruc::Restruc(Reflo const &reflo, Recontex const &recontex)
     : reflo_(reflo)
     , recontex_(recontex)
     , pe_(reflo.get_pe())
-    , max_analyzing_threads_(std::thread::hardware_concurrency())
+    , executor_(reflo.get_executor())
 {
 }
 
@@ -33,10 +148,21 @@ void Restruc::analyze()
 #ifdef DEBUG_ANALYSIS_PROGRESS
     std::clog << "Waiting for analysis to finish ...\n";
 #endif
-    wait_for_analysis();
+    executor_->wait();
 #ifdef DEBUG_ANALYSIS_PROGRESS
     std::clog << "Done.\n";
 #endif
+    link();
+}
+
+void Restruc::analyze(Flo &flo)
+{
+    analyze_flo(flo);
+}
+
+void Restruc::link()
+{
+    number_strucs();
     for (auto const &[address, flo] : reflo_.get_flos()) {
         // No reference, no link
         if (flo->get_references().empty()) {
@@ -51,15 +177,16 @@ void Restruc::analyze()
 #ifdef DEBUG_ANALYSIS_PROGRESS
     std::clog << "Waiting for analysis to finish ...\n";
 #endif
-    wait_for_analysis();
+    executor_->wait();
 #ifdef DEBUG_ANALYSIS_PROGRESS
     std::clog << "Done.\n";
 #endif
+    merge_linked_strucs();
 }
 
 void Restruc::set_max_analyzing_threads(size_t amount)
 {
-    max_analyzing_threads_ = amount;
+    executor_->set_workers_count(amount);
 }
 
 Restruc::FloDomain *Restruc::get_flo_domain(Flo const &flo)
@@ -72,21 +199,9 @@ Restruc::FloDomain *Restruc::get_flo_domain(Flo const &flo)
 
 void Restruc::run_analysis(Flo &flo, void (Restruc::*callback)(Flo &))
 {
-    auto lock = std::unique_lock(analyzing_threads_mutex_);
-    analyzing_threads_cv_.wait(lock, [this] {
-        return analyzing_threads_count_ < max_analyzing_threads_;
-    });
-    ++analyzing_threads_count_;
-    analyzing_threads_.emplace_back([this, &flo, callback]() mutable {
-        ScopeGuard decrement_analyzing_threads_count([this]() noexcept {
-            std::scoped_lock<std::mutex> notify_guard(analyzing_threads_mutex_);
-            --analyzing_threads_count_;
-            analyzing_threads_cv_.notify_all();
-        });
+    executor_->submit([this, &flo, callback] {
 #ifdef DEBUG_ANALYSIS_PROGRESS
-        std::clog << "Running analysis on: " << std::dec
-                  << analyzing_threads_.size() << '/' << std::dec
-                  << reflo_.get_flos().size() << ": " << std::setfill('0')
+        std::clog << "Running analysis on: " << std::setfill('0')
                   << std::setw(8) << std::hex
                   << pe_.raw_to_virtual_address(flo.entry_point) << '\n';
 #endif
@@ -94,14 +209,6 @@ void Restruc::run_analysis(Flo &flo, void (Restruc::*callback)(Flo &))
     });
 }
 
-void Restruc::wait_for_analysis()
-{
-    std::for_each(analyzing_threads_.begin(),
-                  analyzing_threads_.end(),
-                  [](std::thread &t) { t.join(); });
-    analyzing_threads_.clear();
-}
-
 void Restruc::analyze_flo(Flo &flo)
 {
 #ifdef DEBUG_ANALYSIS
@@ -112,52 +219,64 @@ void Restruc::analyze_flo(Flo &flo)
               << pe_.raw_to_virtual_address(flo.entry_point) << " ...\n";
 #endif
     FloDomain flo_domain;
-    ValueGroups groups;
     auto const &disassembly = flo.get_disassembly();
     auto const &flo_contexts = recontex_.get_contexts(flo);
+    // Only instructions which access memory through a possible struc
+    // pointer have their contexts looked at
+    std::vector<std::pair<Address, DecodedInstruction const *>> candidates;
     for (auto const &[address, instruction] : disassembly) {
-#ifdef DEBUG_ANALYSIS
-        DWORD va = pe_.raw_to_virtual_address(address);
-#endif
         for (ZyanU8 i = 0; i < instruction->operand_count; i++) {
             auto const &op = instruction->operands[i];
-            if (op.visibility != ZYDIS_OPERAND_VISIBILITY_EXPLICIT) {
-                continue;
-            }
-            if (op.type == ZYDIS_OPERAND_TYPE_MEMORY
+            if (op.visibility == ZYDIS_OPERAND_VISIBILITY_EXPLICIT
+                && op.type == ZYDIS_OPERAND_TYPE_MEMORY
                 && op.mem.base != ZYDIS_REGISTER_NONE
                 // TODO: analyze stack
                 && op.mem.base != ZYDIS_REGISTER_RSP
                 && op.mem.base != ZYDIS_REGISTER_RIP) {
-                for (auto const &context :
-                     utils::multimap_values(flo_contexts, address)) {
-                    if (auto reg = context.get_register(op.mem.base); reg) {
-                        if (!reg->is_symbolic()
-                            && Recontex::points_to_stack(reg->value())) {
-                            continue;
-                        }
+                candidates.emplace_back(address, instruction);
+                break;
+            }
+        }
+    }
+    ValueGroups groups;
+    std::unordered_map<virt::Value, size_t> group_indices;
+    for (auto const &[address, instruction] : candidates) {
 #ifdef DEBUG_ANALYSIS
-                        std::clog << "group ";
-                        dumper.dump_value(std::clog, *reg);
-                        std::clog
-                            << " \tbase_regs: "
-                            << (reg->source() ?
-                                    pe_.raw_to_virtual_address(reg->source()) :
-                                    0)
-                            << " -> " << ZydisRegisterGetString(op.mem.base);
-                        std::clog << " \trel_instr: ";
-                        dumper.dump_instruction(std::clog, va, *instruction);
+        DWORD va = pe_.raw_to_virtual_address(address);
 #endif
-                        auto &group = groups[*reg];
-                        group.relevant_instructions.emplace(address,
-                                                            instruction.get());
-                        group.base_regs.emplace(reg->source(), op.mem.base);
-                    }
-                }
+        auto const &op = *get_memory_operand(*instruction);
+        for (auto const &context : flo_contexts.get(address)) {
+            auto reg = context.get_register(op.mem.base);
+            if (!reg
+                || (!reg->is_symbolic()
+                    && Recontex::points_to_stack(reg->value()))) {
+                continue;
             }
+#ifdef DEBUG_ANALYSIS
+            std::clog << "group ";
+            dumper.dump_value(std::clog, *reg);
+            std::clog << " \tbase_regs: "
+                      << (reg->source() ?
+                              pe_.raw_to_virtual_address(reg->source()) :
+                              0)
+                      << " -> " << ZydisRegisterGetString(op.mem.base);
+            std::clog << " \trel_instr: ";
+            dumper.dump_instruction(std::clog, va, *instruction);
+#endif
+            auto [it, inserted] =
+                group_indices.try_emplace(*reg, groups.values.size());
+            if (inserted) {
+                groups.values.push_back(*reg);
+            }
+            groups.accesses.push_back(ValueGroups::Access{ it->second,
+                                                           address,
+                                                           instruction,
+                                                           reg->source(),
+                                                           op.mem.base });
         }
     }
     if (!groups.empty()) {
+        sort_value_groups(groups);
         create_flo_strucs(flo, flo_domain, std::move(groups));
         intra_link_flo_strucs(flo, flo_contexts, flo_domain);
     }
@@ -166,6 +285,33 @@ void Restruc::analyze_flo(Flo &flo)
     }
 }
 
+void Restruc::sort_value_groups(ValueGroups &groups)
+{
+    auto &values = groups.values;
+    std::vector<size_t> order(values.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::sort(order.begin(), order.end(), [&values](size_t a, size_t b) {
+        return values[a] < values[b];
+    });
+    std::vector<size_t> ranks(values.size());
+    std::vector<virt::Value> sorted_values;
+    sorted_values.reserve(values.size());
+    for (size_t i = 0; i < order.size(); i++) {
+        ranks[order[i]] = i;
+        sorted_values.push_back(std::move(values[order[i]]));
+    }
+    values = std::move(sorted_values);
+    for (auto &access : groups.accesses) {
+        access.group = ranks[access.group];
+    }
+    // Accesses are collected in the order of addresses
+    std::stable_sort(groups.accesses.begin(),
+                     groups.accesses.end(),
+                     [](auto const &a, auto const &b) {
+                         return a.group < b.group;
+                     });
+}
+
 void Restruc::create_flo_strucs(Flo &flo,
                                 FloDomain &flo_domain,
                                 ValueGroups &&groups)
@@ -179,27 +325,48 @@ void Restruc::create_flo_strucs(Flo &flo,
     std::clog << std::setfill('0') << std::hex << std::right
               << pe_.raw_to_virtual_address(flo.entry_point) << ":\n";
 #endif
-    for (auto &&[value, sd] : groups) {
+    auto const &accesses = groups.accesses;
+    for (auto first = accesses.begin(); first != accesses.end();) {
+        auto const &value = groups.values[first->group];
+        auto last = std::find_if(first, accesses.end(), [&](auto const &a) {
+            return a.group != first->group;
+        });
 #ifdef DEBUG_ANALYSIS
         dumper.dump_value(std::clog, value);
         std::clog << ":\n";
 #endif
-        sd.struc = std::make_shared<Struc>(generate_struc_name(flo, value));
-        for (auto const [address, instruction] : sd.relevant_instructions) {
+        StrucDomain sd;
+        // Fields are added without locking, the struc stays private
+        // to this task until the flo domain is added
+        sd.struc = std::make_unique<Struc>(next_struc_id_++);
+        for (auto it = first; it != last; ++it) {
+            auto [regs_first, regs_last] = sd.base_regs.equal_range(it->source);
+            if (std::none_of(regs_first, regs_last, [it](auto const &entry) {
+                    return entry.second == it->base_reg;
+                })) {
+                sd.base_regs.emplace(it->source, it->base_reg);
+            }
+            // Contexts of an instruction share its fields
+            if (it != first && std::prev(it)->address == it->address) {
+                continue;
+            }
 #ifdef DEBUG_ANALYSIS
             dumper.dump_instruction(std::clog,
-                                    pe_.raw_to_virtual_address(address),
-                                    *instruction);
+                                    pe_.raw_to_virtual_address(it->address),
+                                    *it->instruction);
 #endif
-            add_struc_field(flo, address, *sd.struc, *instruction);
+            add_struc_field(flo, it->address, *sd.struc, *it->instruction);
         }
 #ifdef DEBUG_ANALYSIS
         std::clog << '\n';
-        sd.struc->print(std::clog);
+        sd.struc->print(std::clog, [&](Struc const &) {
+            return generate_struc_name(flo, value);
+        });
         std::clog << '\n';
 #endif
         sd.base_flo = &flo;
         flo_domain.strucs.emplace(value, std::move(sd));
+        first = last;
     }
 #ifdef DEBUG_ANALYSIS
     std::clog << '\n';
@@ -228,8 +395,7 @@ void Restruc::intra_link_flo_strucs(Flo &flo,
             if (src.type != ZYDIS_OPERAND_TYPE_MEMORY) {
                 continue;
             }
-            for (auto const &context :
-                 utils::multimap_values(flo_contexts, value.source())) {
+            for (auto const &context : flo_contexts.get(value.source())) {
                 if (auto reg = context.get_register(src.mem.base); reg) {
                     if (auto it = strucs.find(*reg); it != strucs.end()) {
                         auto &parent_struc = *it->second.struc;
@@ -241,8 +407,10 @@ void Restruc::intra_link_flo_strucs(Flo &flo,
                             offset = src.mem.disp.value;
                         }
 #ifdef DEBUG_INTRA_LINK
-                        std::clog << "Linking " << sd.struc->name() << " with "
-                                  << parent_struc.name() << " by "
+                        std::clog << "Linking "
+                                  << generate_struc_name(flo, value) << " with "
+                                  << generate_struc_name(flo, it->first)
+                                  << " by "
                                   << ZydisRegisterGetString(src.mem.base) << ' ';
                         dumper.dump_value(std::clog, *reg);
                         std::clog << " : ";
@@ -266,12 +434,16 @@ void Restruc::add_flo_domain(Flo &flo, FloDomain &&flo_domain)
     std::scoped_lock<std::mutex, std::mutex> add_strucs_guard(
         modify_access_domains_mutex_,
         modify_access_strucs_mutex_);
-    for (auto &[_, domain] : flo_domain.strucs) {
-        strucs_.emplace(domain.struc->name(), domain.struc);
-    }
     auto [it, inserted] =
         domains_.emplace(flo.entry_point, std::move(flo_domain));
     assert(inserted);
+    for (auto const &[value, sd] : it->second.strucs) {
+        auto id = sd.struc->id();
+        if (id >= strucs_.size()) {
+            strucs_.resize(id + 1);
+        }
+        strucs_[id] = StrucEntry{ sd.struc.get(), &flo, &value, id };
+    }
 }
 
 void Restruc::inter_link_flo_strucs(Flo &flo)
@@ -303,8 +475,7 @@ void Restruc::inter_link_flo_strucs(Flo &flo)
                 continue;
             }
             std::unordered_set<int> linked_arg;
-            for (auto const &context :
-                 utils::multimap_values(flo_contexts, value.source())) {
+            for (auto const &context : flo_contexts.get(value.source())) {
                 if (auto address = Recontex::get_memory_address(src, context);
                     !address.is_symbolic()) {
                     auto argument =
@@ -343,7 +514,7 @@ void Restruc::inter_link_flo_strucs_via_stack(
                   << pe_.raw_to_virtual_address(flo.entry_point)
                   << " via reference @ " << std::setw(8)
                   << pe_.raw_to_virtual_address(ref) << " * "
-                  << sd.struc->name() << '\n';
+                  << get_struc_name(*sd.struc) << '\n';
 #endif
         auto const ref_flo = reflo_.get_flo_by_address(ref);
         assert(ref_flo);
@@ -364,8 +535,7 @@ void Restruc::inter_link_flo_strucs_via_stack(
             inter_link_flo_strucs_via_stack(*ref_flo, sd, argument, visited);
             return;
         }
-        for (auto const &context :
-             utils::multimap_values(ref_flo_contexts, ref)) {
+        for (auto const &context : ref_flo_contexts.get(ref)) {
             auto rsp = context.get_register(ZYDIS_REGISTER_RSP);
             virt::Value arg = context.get_memory(
                 rsp->raw_address_value() + stack_offset + argument * 8,
@@ -392,8 +562,8 @@ void Restruc::inter_link_flo_strucs_via_stack(
                 if (dst.type == ZYDIS_OPERAND_TYPE_MEMORY
                     && dst.mem.base == ZYDIS_REGISTER_RSP
                     && src.type == ZYDIS_OPERAND_TYPE_REGISTER) {
-                    for (auto const &context : utils::multimap_values(
-                             ref_flo_contexts, arg.source())) {
+                    for (auto const &context :
+                         ref_flo_contexts.get(arg.source())) {
                         auto reg = context.get_register(src.reg.value);
                         if (!reg) {
                             continue;
@@ -431,7 +601,7 @@ void Restruc::inter_link_flo_strucs_via_register(
                   << pe_.raw_to_virtual_address(flo.entry_point)
                   << " via reference @ " << std::setw(8)
                   << pe_.raw_to_virtual_address(ref) << " * "
-                  << sd.struc->name() << '\n';
+                  << get_struc_name(*sd.struc) << '\n';
 #endif
         auto const ref_flo = reflo_.get_flo_by_address(ref);
         assert(ref_flo);
@@ -444,8 +614,7 @@ void Restruc::inter_link_flo_strucs_via_register(
             // let's try to deeper.
             inter_link_flo_strucs_via_register(*ref_flo, sd, base_reg, visited);
         }
-        for (auto const &context :
-             utils::multimap_values(ref_flo_contexts, ref)) {
+        for (auto const &context : ref_flo_contexts.get(ref)) {
             auto val = context.get_register(base_reg);
             if (!val) {
                 continue;
@@ -488,8 +657,7 @@ void Restruc::inter_link_flo_strucs(Flo const &flo,
         auto const &src = instruction.operands[1];
         if (src.type == ZYDIS_OPERAND_TYPE_MEMORY
             && src.mem.base != ZYDIS_REGISTER_NONE) {
-            for (auto const &context :
-                 utils::multimap_values(ref_flo_contexts, link)) {
+            for (auto const &context : ref_flo_contexts.get(link)) {
                 auto reg = context.get_register(src.mem.base);
                 if (!reg) {
                     continue;
@@ -506,66 +674,175 @@ void Restruc::inter_link_flo_strucs(Flo const &flo,
                 }
                 auto &parent_struc = *parent_sd.struc;
 #ifdef DEBUG_INTER_LINK
-                std::clog << "Linking " << sd.struc->name() << " with "
-                          << parent_struc.name() << '\n';
-#endif
-                {
-                    std::scoped_lock<std::mutex> merge_lock(
-                        merge_strucs_mutex_); // TODO: get rid of it
-                    try_merge_struc_field_at_offset(
-                        *sd.struc,
-                        parent_struc,
-                        offset,
-                        [this](Struc const &dst, Struc const &src) {
-#ifdef DEBUG_MERGE
-                            std::clog << "Merged " << src.name() << " into "
-                                      << dst.name() << '\n';
+                std::clog << "Linking " << get_struc_name(*sd.struc)
+                          << " with " << get_struc_name(parent_struc) << '\n';
 #endif
-                            std::scoped_lock<std::mutex> modify_guard(
-                                modify_access_strucs_mutex_);
-                            strucs_.erase(src.name());
-                        });
-                }
-                {
-                    std::scoped_lock<std::recursive_mutex> modify_guard(
-                        parent_struc.mutex());
-                    parent_struc.add_pointer_field(offset, 1, sd.struc.get());
-                }
+                // Recorded without locking, only the task linking
+                // `sd.base_flo` touches its domain
+                get_flo_domain(*sd.base_flo)
+                    ->links.push_back(StrucLink{ sd.struc.get(),
+                                                 &parent_struc,
+                                                 static_cast<size_t>(offset) });
             }
         }
     }
 }
 
-void Restruc::try_merge_struc_field_at_offset(
-    Struc &dst,
-    Struc const &src,
-    size_t offset,
-    Struc::MergeCallback merge_callback)
+void Restruc::number_strucs()
 {
-    if (&dst == &src) {
-        return;
+    // Ids are taken in the order the flo tasks run, so the strucs are
+    // numbered by their flo and value for linking not to depend on it
+    std::vector<StrucEntry> strucs;
+    strucs.reserve(strucs_.size());
+    for (auto const &[entry_point, flo_domain] : domains_) {
+        std::vector<std::pair<virt::Value const *, StrucDomain const *>>
+            flo_strucs;
+        for (auto const &[value, sd] : flo_domain.strucs) {
+            flo_strucs.emplace_back(&value, &sd);
+        }
+        std::sort(flo_strucs.begin(),
+                  flo_strucs.end(),
+                  [](auto const &a, auto const &b) {
+                      return *a.first < *b.first;
+                  });
+        for (auto [value, sd] : flo_strucs) {
+            Struc::Id id = strucs.size();
+            sd->struc->set_id(id);
+            strucs.push_back(
+                StrucEntry{ sd->struc.get(), sd->base_flo, value, id });
+        }
+    }
+    strucs_ = std::move(strucs);
+    next_struc_id_ = strucs_.size();
+}
+
+void Restruc::merge_linked_strucs()
+{
+    // Strucs of a flo are linked in the flo's domain. Links are sorted,
+    // so the classes and their representatives don't depend on the order
+    // the linking tasks ran in.
+    std::vector<StrucLink const *> sorted_links;
+    for (auto const &[entry_point, flo_domain] : domains_) {
+        for (auto const &link : flo_domain.links) {
+            sorted_links.push_back(&link);
+        }
+    }
+    std::sort(sorted_links.begin(),
+              sorted_links.end(),
+              [](StrucLink const *a, StrucLink const *b) {
+                  return std::tuple(a->parent->id(), a->offset, a->child->id())
+                         < std::tuple(
+                             b->parent->id(), b->offset, b->child->id());
+              });
+    size_t count = strucs_.size();
+    std::vector<StrucClasses::Pointers> pointers(count);
+    for (size_t i = 0; i < count; i++) {
+        for (auto const &[offset, field] : strucs_[i].struc->fields()) {
+            if (field.type() == Struc::Field::Pointer && field.struc()) {
+                pointers[i].emplace_back(offset, field.struc()->id());
+            }
+        }
+    }
+    StrucClasses classes(std::move(pointers));
+    // A linked child is merged with the struc its parent
+    // already points to at the offset
+    for (auto link : sorted_links) {
+        auto parent = link->parent->id();
+        auto [offset, pointee] = get_pointer_field(*link->parent, link->offset);
+        if (pointee) {
+            classes.add_target(parent, offset, pointee->id());
+        }
+        classes.add_target(parent, offset, link->child->id());
+    }
+    // Class -> members and links whose parents are in the class
+    std::vector<size_t> representatives(count);
+    std::map<size_t, std::vector<size_t>> members;
+    std::unordered_map<size_t, std::vector<StrucLink const *>> links;
+    for (size_t i = 0; i < count; i++) {
+        representatives[i] = classes.find(i);
+        members[representatives[i]].push_back(i);
     }
-    std::scoped_lock<std::recursive_mutex> modify_guard(src.mutex());
-    for (auto it = std::reverse_iterator(src.fields().upper_bound(offset));
-         it != src.fields().rend();
-         ++it) {
-        auto &src_field = it->second;
-        auto src_field_offset = it->first;
-        auto src_field_offset_end =
-            src_field_offset + src_field.count() * src_field.size();
-        if (src_field_offset_end <= offset) {
-            break;
-        }
-        if (src_field.type() != Struc::Field::Type::Pointer
-            || !src_field.struc() || src_field_offset % 8 != offset % 8) {
+    for (auto link : sorted_links) {
+        links[representatives[link->parent->id()]].push_back(link);
+    }
+    auto redirect = [&](Struc const *struc) -> Struc const * {
+        return strucs_[representatives[struc->id()]].struc;
+    };
+    auto merge_class = [&](size_t representative,
+                           std::vector<size_t> const &class_members) {
+        auto &struc = *strucs_[representative].struc;
+        for (auto member : class_members) {
+            if (member == representative) {
+                continue;
+            }
+#ifdef DEBUG_MERGE
+            std::clog << "Merged " << get_struc_name(*strucs_[member].struc)
+                      << " into " << get_struc_name(struc) << '\n';
+#endif
+            struc.merge(*strucs_[member].struc);
+        }
+        if (auto it = links.find(representative); it != links.end()) {
+            for (auto link : it->second) {
+                struc.add_pointer_field(link->offset,
+                                        1,
+                                        redirect(link->child));
+            }
+        }
+    };
+    // Sizes of embedded strucs are read while merging, so classes with
+    // struc fields are merged one by one. The others share no strucs
+    // and are merged concurrently.
+    std::vector<size_t> serial_classes;
+    for (auto const &[representative, class_members] : members) {
+        if (std::any_of(class_members.begin(),
+                        class_members.end(),
+                        [this](size_t member) {
+                            return strucs_[member].struc->has_struc_fields();
+                        })) {
+            serial_classes.push_back(representative);
             continue;
         }
-        dst.merge(*src_field.struc(), merge_callback);
+        executor_->submit([&, representative] {
+            merge_class(representative, class_members);
+        });
+    }
+    executor_->wait();
+    for (auto representative : serial_classes) {
+        merge_class(representative, members.at(representative));
+    }
+    // Pointers are redirected once every class is merged
+    for (auto const &[representative, class_members] : members) {
+        strucs_[representative].struc->redirect_strucs(redirect);
+    }
+    // Merged strucs forward to their representatives
+    for (size_t i = 0; i < count; i++) {
+        strucs_[i].forward = representatives[i];
+    }
+    for (auto &[entry_point, flo_domain] : domains_) {
+        flo_domain.links.clear();
+    }
+}
+
+std::vector<Struc const *> Restruc::get_strucs() const
+{
+    std::vector<Struc const *> strucs;
+    for (auto const &entry : strucs_) {
+        // Ids of flos which are still analyzed might be missing
+        if (entry.struc && entry.forward == entry.struc->id()) {
+            strucs.push_back(entry.struc);
+        }
     }
+    return strucs;
+}
+
+std::string Restruc::get_struc_name(Struc const &struc) const
+{
+    auto const &entry = strucs_[struc.id()];
+    return generate_struc_name(*entry.base_flo, *entry.value);
 }
 
 std::string Restruc::generate_struc_name(Flo const &flo,
-                                         virt::Value const &value)
+                                         virt::Value const &value) const
 {
     std::ostringstream oss;
     oss << std::hex << "rs_";
@@ -590,7 +867,7 @@ std::string Restruc::generate_struc_name(Flo const &flo,
 void Restruc::add_struc_field(Flo const &flo,
                               Address address,
                               Struc &struc,
-                              ZydisDecodedInstruction const &instruction)
+                              DecodedInstruction const &instruction)
 {
     auto mem_op = get_memory_operand(instruction);
     if (!mem_op) {
@@ -630,8 +907,8 @@ void Restruc::add_struc_field(Flo const &flo,
     }
 }
 
-ZydisDecodedOperand const *
-Restruc::get_memory_operand(ZydisDecodedInstruction const &instruction)
+DecodedOperand const *
+Restruc::get_memory_operand(DecodedInstruction const &instruction)
 {
     for (ZyanU8 i = 0; i < instruction.operand_count; i++) {
         auto const &op = instruction.operands[i];
@@ -646,7 +923,7 @@ Restruc::get_memory_operand(ZydisDecodedInstruction const &instruction)
 // Returns count for Field by analyzing cycles (if any)
 size_t Restruc::get_field_count(Flo const &flo,
                                 Address address,
-                                ZydisDecodedOperand const &mem_op)
+                                DecodedOperand const &mem_op)
 {
     auto const &contexts = recontex_.get_contexts(flo);
     auto const &cycles = flo.get_cycles(address);
@@ -656,13 +933,12 @@ size_t Restruc::get_field_count(Flo const &flo,
     }
     for (auto const &cycle : cycles) {
         ZydisRegister exit_reg = ZYDIS_REGISTER_NONE;
-        for (auto const &context : utils::multimap_values(contexts, address)) {
+        for (auto const &context : contexts.get(address)) {
             auto index = context.get_register(mem_op.mem.index);
             if (!index) {
                 continue;
             }
-            for (auto const &exit_context :
-                 utils::multimap_values(contexts, cycle->last)) {
+            for (auto const &exit_context : contexts.get(cycle->last)) {
                 for (auto const &[er, ec] : cycle->exit_conditions) {
                     auto reg = exit_context.get_register(er);
                     if (!reg) {
@@ -691,8 +967,7 @@ size_t Restruc::get_field_count(Flo const &flo,
                     }
                     break;
                 case ZYDIS_OPERAND_TYPE_REGISTER:
-                    for (auto const &context :
-                         utils::multimap_values(contexts, address)) {
+                    for (auto const &context : contexts.get(address)) {
                         if (auto value = context.get_register(op2.reg.value);
                             value) {
                             if (!value->is_symbolic()) {
@@ -702,8 +977,7 @@ size_t Restruc::get_field_count(Flo const &flo,
                     }
                     break;
                 case ZYDIS_OPERAND_TYPE_MEMORY:
-                    for (auto const &context :
-                         utils::multimap_values(contexts, address)) {
+                    for (auto const &context : contexts.get(address)) {
                         auto address =
                             Recontex::get_memory_address(op2, context)
                                 .raw_address_value();
@@ -739,8 +1013,40 @@ void Restruc::dump(std::ostream &os)
 {
     auto flags = os.flags();
     os << std::setfill('0');
-    for (auto const &[name, struc] : strucs_) {
-        struc->print(os);
+    // Names are only generated for the strucs left, which are dumped
+    // in the order of their names
+    std::vector<std::pair<std::string, Struc const *>> strucs;
+    for (auto struc : get_strucs()) {
+        strucs.emplace_back(get_struc_name(*struc), struc);
+    }
+    std::stable_sort(strucs.begin(),
+                     strucs.end(),
+                     [](auto const &a, auto const &b) {
+                         return a.first < b.first;
+                     });
+    // Values loaded by the same instruction share a name,
+    // the later strucs are told apart by a suffix
+    for (size_t first = 0; first < strucs.size();) {
+        size_t last = first + 1;
+        while (last < strucs.size()
+               && strucs[last].first == strucs[first].first) {
+            last++;
+        }
+        for (size_t i = first + 1; i < last; i++) {
+            strucs[i].first += "_v" + std::to_string(i - first + 1);
+        }
+        first = last;
+    }
+    std::vector<std::string const *> names(strucs_.size());
+    for (auto const &[name, struc] : strucs) {
+        names[struc->id()] = &name;
+    }
+    auto namer = [this, &names](Struc const &struc) {
+        auto name = names[struc.id()];
+        return name ? *name : get_struc_name(struc);
+    };
+    for (auto const &[name, struc] : strucs) {
+        struc->print(os, namer);
         os << '\n';
     }
     os.flags(flags);
@@ -4,7 +4,7 @@
 #include "reflo.hxx"
 #include "struc.hxx"
 
-#include <condition_variable>
+#include <atomic>
 #include <iosfwd>
 #include <memory>
 #include <mutex>
@@ -18,15 +18,22 @@ namespace rstc {
     class Restruc {
     public:
         struct StrucDomain {
-            std::shared_ptr<Struc> struc;
+            std::unique_ptr<Struc> struc;
             Flo const *base_flo;
-            std::map<Address, ZydisDecodedInstruction const *>
-                relevant_instructions;
             std::unordered_multimap<Address, ZydisRegister> base_regs;
         };
 
+        // Child struc is loaded from the parent struc at the offset
+        struct StrucLink {
+            Struc *child;
+            Struc *parent;
+            size_t offset;
+        };
+
         struct FloDomain {
             std::unordered_map<virt::Value, StrucDomain> strucs;
+            // Found by inter-linking, merged once all flos are linked
+            std::vector<StrucLink> links;
 
             inline bool empty() const { return strucs.empty(); }
         };
@@ -34,29 +41,55 @@ namespace rstc {
         Restruc(Reflo const &reflo, Recontex const &recontex);
 
         void analyze();
+        // Analyzes a single flo, can be called concurrently.
+        // `link` must be called once all flos are analyzed.
+        void analyze(Flo &flo);
+        void link();
         void set_max_analyzing_threads(size_t amount);
 
         void dump(std::ostream &os);
 
-        inline std::map<std::string, std::shared_ptr<Struc>> const &
-        get_strucs() const
-        {
-            return strucs_;
-        }
+        // Strucs left after merging, in the order of their ids
+        std::vector<Struc const *> get_strucs() const;
+        std::string get_struc_name(Struc const &struc) const;
 
     private:
-        using ValueGroups = std::map<virt::Value, StrucDomain>;
+        // Memory accesses of a flo grouped by the value of their base
+        // register. Accesses are sorted by group, then by address,
+        // groups are sorted by value.
+        struct ValueGroups {
+            struct Access {
+                size_t group;
+                Address address;
+                DecodedInstruction const *instruction;
+                Address source;
+                ZydisRegister base_reg;
+            };
+
+            std::vector<virt::Value> values;
+            std::vector<Access> accesses;
+
+            inline bool empty() const { return accesses.empty(); }
+        };
         struct StrucDomainBase {
             Address source;
             ZydisRegister root_reg;
         };
+        // Owned by the domain of `base_flo`, where `value` is its key.
+        // A merged struc forwards to the struc of its class.
+        struct StrucEntry {
+            Struc *struc;
+            Flo const *base_flo;
+            virt::Value const *value;
+            Struc::Id forward;
+        };
 
         FloDomain *get_flo_domain(Flo const &flo);
 
         void run_analysis(Flo &flo, void (Restruc::*callback)(Flo &));
-        void wait_for_analysis();
 
         void analyze_flo(Flo &flo);
+        static void sort_value_groups(ValueGroups &groups);
         void
         create_flo_strucs(Flo &flo, FloDomain &flo_info, ValueGroups &&groups);
         void intra_link_flo_strucs(Flo &flo,
@@ -80,24 +113,21 @@ namespace rstc {
                                    Flo const &ref_flo,
                                    Address link);
 
-        void
-        try_merge_struc_field_at_offset(Struc &dst,
-                                        Struc const &src,
-                                        size_t offset,
-                                        Struc::MergeCallback merge_callback);
+        void number_strucs();
+        void merge_linked_strucs();
 
         std::string generate_struc_name(Flo const &flo,
-                                        virt::Value const &value);
-        static ZydisDecodedOperand const *
-        get_memory_operand(ZydisDecodedInstruction const &instruction);
+                                        virt::Value const &value) const;
+        static DecodedOperand const *
+        get_memory_operand(DecodedInstruction const &instruction);
         static bool is_less_than_jump(ZydisMnemonic mnemonic);
         size_t get_field_count(Flo const &flo,
                                Address address,
-                               ZydisDecodedOperand const &mem_op);
+                               DecodedOperand const &mem_op);
         void add_struc_field(Flo const &flo,
                              Address address,
                              Struc &struc,
-                             ZydisDecodedInstruction const &instruction);
+                             DecodedInstruction const &instruction);
 
         Reflo const &reflo_;
         Recontex const &recontex_;
@@ -106,18 +136,13 @@ namespace rstc {
         std::mutex modify_access_domains_mutex_;
         std::mutex modify_access_strucs_mutex_;
 
-        // TODO: try to get rid of it: build graph of struct references and link
-        // them parallely
-        std::mutex merge_strucs_mutex_;
-
         std::map<Address, FloDomain> domains_;
-        std::map<std::string, std::shared_ptr<Struc>> strucs_;
+        // Indexed by `Struc::Id`, strucs are numbered again by
+        // `number_strucs` before linking
+        std::vector<StrucEntry> strucs_;
+        std::atomic<Struc::Id> next_struc_id_ = 0;
 
-        size_t max_analyzing_threads_;
-        std::atomic<size_t> analyzing_threads_count_ = 0;
-        std::vector<std::thread> analyzing_threads_;
-        std::mutex analyzing_threads_mutex_;
-        std::condition_variable analyzing_threads_cv_;
+        std::shared_ptr<Executor> executor_;
     };
 
 }
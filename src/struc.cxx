@@ -1,9 +1,8 @@
 #include "struc.hxx"
 
-#include "utils/adapters.hxx"
-
 #include <algorithm>
 #include <cassert>
+#include <cstdint>
 #include <iomanip>
 #include <iostream>
 
@@ -41,7 +40,7 @@ bool Struc::Field::is_typed_int_alias(size_t size) const
     return type_ == Int || type_ == UInt || type_ == Float || type_ == Pointer;
 }
 
-std::string Struc::Field::type_to_string() const
+std::string Struc::Field::type_to_string(Namer const &namer) const
 {
     switch (type_) {
     case Struc::Field::UInt:
@@ -70,19 +69,19 @@ std::string Struc::Field::type_to_string() const
         break;
     case Struc::Field::Pointer:
         if (struc_) {
-            return struc_->name() + "*";
+            return namer(*struc_) + "*";
         }
         else {
             return "void*";
         }
         break;
-    case Struc::Field::Struc: return struc_->name(); break;
+    case Struc::Field::Struc: return namer(*struc_); break;
     }
     return "";
 }
 
-Struc::Struc(std::string name)
-    : name_(std::move(name))
+Struc::Struc(Id id)
+    : id_(id)
 {
 }
 
@@ -130,76 +129,51 @@ void Struc::add_field(size_t offset, Field field)
     if (is_duplicate(offset, field)) {
         return;
     }
-    {
-        std::scoped_lock<std::recursive_mutex> modify_guard(mutex());
-        for (size_t i = 0; i < field.count(); i++) {
-            field_set_.insert(offset + i * field.size());
-        }
-        fields_.emplace(offset, std::move(field));
+    if (field.type() == Field::Struc) {
+        struc_fields_count_++;
     }
+    size_t position = equal_range(offset).second;
+    fields_.emplace(fields_.begin() + position, offset, std::move(field));
+    update_index(position);
 }
 
 bool Struc::is_duplicate(size_t offset, Field const &field) const
 {
-    if (fields_.empty()) {
-        return false;
-    }
-    for (auto it = std::reverse_iterator(fields_.upper_bound(offset));
-         it != fields_.rend();
-         ++it) {
-        auto const &current_field = it->second;
-        auto current_offset = it->first;
-        auto current_offset_end =
-            current_offset + current_field.count() * current_field.size();
-        if (current_offset_end <= offset) {
-            break;
-        }
+    return visit_fields_at(offset, [offset, &field](
+                                       size_t current_offset,
+                                       Field const &current_field) {
         if (current_field.size() != field.size()) {
-            continue;
+            return false;
         }
         // Alignment check
         if (current_offset % field.size() != offset % field.size()) {
-            continue;
+            return false;
         }
         // TODO: use better type priorities
         switch (current_field.type()) {
         case Field::Type::UInt:
         case Field::Type::Int:
-            if (field.is_typed_int_alias(current_field.size())
-                && field.type() <= current_field.type()) {
-                return true;
-            }
-            break;
+            return field.is_typed_int_alias(current_field.size())
+                   && field.type() <= current_field.type();
         case Field::Type::Float:
-            if (field.is_float_alias(current_field.size())
-                && field.type() <= current_field.type()) {
-                return true;
-            }
-            break;
+            return field.is_float_alias(current_field.size())
+                   && field.type() <= current_field.type();
         case Field::Type::Pointer:
-            if (field.is_pointer_alias(current_field.size())
-                && field.type() <= current_field.type()) {
-                return true;
-            }
-            break;
-        case Field::Type::Struc:
-            if (field.type() == current_field.type()) {
-                return true;
-            }
-            break;
+            return field.is_pointer_alias(current_field.size())
+                   && field.type() <= current_field.type();
+        case Field::Type::Struc: return field.type() == current_field.type();
         }
-    }
-    return false;
+        return false;
+    });
 }
 
 bool Struc::has_aliases(size_t offset,
                         bool (Field::*alias_check)(size_t size) const,
                         size_t size)
 {
-    for (auto it = fields_.find(offset);
-         it != fields_.end() && it->first == offset;
-         ++it) {
-        if ((it->second.*alias_check)(size)) {
+    auto [first, last] = equal_range(offset);
+    for (size_t i = first; i < last; i++) {
+        if ((fields_[i].second.*alias_check)(size)) {
             return true;
         }
     }
@@ -211,64 +185,54 @@ size_t Struc::remove_aliases(size_t offset,
                              size_t size)
 {
     size_t count = 1;
-    for (auto it = fields_.find(offset);
-         it != fields_.end() && it->first == offset;) {
-        count = std::max(count, it->second.count());
-        if ((it->second.*alias_check)(size)) {
-            it = fields_.erase(it);
-        }
-        else {
-            ++it;
-        }
+    auto [first, last] = equal_range(offset);
+    auto it = std::remove_if(
+        fields_.begin() + first,
+        fields_.begin() + last,
+        [&count, alias_check, size](auto const &entry) {
+            auto const &field = entry.second;
+            count = std::max(count, field.count());
+            return (field.*alias_check)(size);
+        });
+    if (auto removed_end = fields_.begin() + last; it != removed_end) {
+        fields_.erase(it, removed_end);
+        update_index(first);
     }
     return count;
 }
 
-void Struc::merge(Struc const &src, MergeCallback merge_callback)
+std::pair<size_t, size_t> Struc::equal_range(size_t offset) const
 {
-    if (this == &src) {
-        return;
-    }
-    {
-        std::scoped_lock<std::recursive_mutex> modify_guard(src.mutex());
-        for (auto const &[offset, field] : src.fields()) {
-            if (!try_merge_struc_field_at_offset(offset,
-                                                 field,
-                                                 merge_callback)) {
-                merge_fields(offset, field);
-            }
-        }
+    auto [first, last] = std::equal_range(
+        fields_.begin(),
+        fields_.end(),
+        std::pair(offset, 0),
+        [](auto const &a, auto const &b) { return a.first < b.first; });
+    return { std::distance(fields_.begin(), first),
+             std::distance(fields_.begin(), last) };
+}
+
+void Struc::update_index(size_t first)
+{
+    max_ends_.resize(fields_.size());
+    for (size_t i = first; i < fields_.size(); i++) {
+        auto const &[offset, field] = fields_[i];
+        size_t end = field.type() != Field::Struc
+                         ? offset + field.count() * field.size()
+                         : SIZE_MAX;
+        max_ends_[i] = i > 0 ? std::max(max_ends_[i - 1], end) : end;
     }
-    merge_callback(*this, src);
+    size_ = compute_size();
 }
 
-bool Struc::try_merge_struc_field_at_offset(size_t offset,
-                                            Field const &src_field,
-                                            MergeCallback merge_callback)
+void Struc::merge(Struc const &src)
 {
-    if (src_field.type() != Struc::Field::Pointer || !src_field.struc()) {
-        return false;
+    if (this == &src) {
+        return;
     }
-    std::scoped_lock<std::recursive_mutex> modify_guard(mutex());
-    bool merged = false;
-    for (auto it = std::reverse_iterator(fields_.upper_bound(offset));
-         it != fields_.rend();
-         ++it) {
-        auto &dst_field = it->second;
-        auto dst_field_offset = it->first;
-        auto dst_field_offset_end =
-            dst_field_offset + dst_field.count() * dst_field.size();
-        if (dst_field_offset_end <= offset) {
-            break;
-        }
-        if (dst_field.type() != Struc::Field::Type::Pointer
-            || !dst_field.struc() || dst_field_offset % 8 != offset % 8) {
-            continue;
-        }
-        dst_field.struc()->merge(*src_field.struc(), merge_callback);
-        merged = true;
+    for (auto const &[offset, field] : src.fields()) {
+        merge_fields(offset, field);
     }
-    return merged;
 }
 
 void Struc::merge_fields(size_t offset, Field const &field)
@@ -291,32 +255,54 @@ void Struc::merge_fields(size_t offset, Field const &field)
     }
 }
 
+void Struc::redirect_strucs(
+    std::function<Struc const *(Struc const *)> const &redirect)
+{
+    for (auto &[offset, field] : fields_) {
+        if (field.struc_) {
+            field.struc_ = redirect(field.struc_);
+        }
+    }
+}
+
 size_t Struc::get_size() const
+{
+    // Embedded strucs might have grown since
+    return struc_fields_count_ ? compute_size() : size_;
+}
+
+size_t Struc::compute_size() const
 {
     if (fields_.empty()) {
         return 0;
     }
     // TODO: fix the case when element before last
     // ends at offset larger than last element
-    auto last_offset = fields_.rbegin()->first;
-    auto last_fields = utils::multimap_values(fields_, last_offset);
-    auto largest_last_field = std::max_element(
-        last_fields.begin(),
-        last_fields.end(),
-        [](Field const &a, Field const &b) { return a.size() < b.size(); });
-    return last_offset + largest_last_field->size();
+    auto last_offset = fields_.back().first;
+    size_t largest_last_size = 0;
+    for (auto it = fields_.rbegin();
+         it != fields_.rend() && it->first == last_offset;
+         ++it) {
+        largest_last_size = std::max(largest_last_size, it->second.size());
+    }
+    return last_offset + largest_last_size;
 }
 
-bool Struc::has_field_at_offset(size_t offset)
+bool Struc::has_field_at_offset(size_t offset) const
 {
-    return field_set_.contains(offset);
+    return visit_fields_at(offset, [offset](size_t field_offset,
+                                            Field const &field) {
+        size_t size = field.size();
+        return size ? (offset - field_offset) % size == 0
+                    : offset == field_offset;
+    });
 }
 
-void Struc::print(std::ostream &os) const
+void Struc::print(std::ostream &os, Namer const &namer) const
 {
     auto os_flags = os.flags();
     os << std::setfill('0');
-    os << "struct " << name_ << " {\n";
+    os << "struct " << namer(*this) << " {\n";
     size_t next_offset = 0;
     for (auto it = fields_.begin(); it != fields_.end();) {
         auto base_offset = it->first;
@@ -351,7 +337,7 @@ void Struc::print(std::ostream &os) const
             auto offset = it->first;
             auto const &field = it->second;
             if (offset == base_offset) {
-                os << indent << field.type_to_string() << ' ' << "field_"
+                os << indent << field.type_to_string(namer) << ' ' << "field_"
                    << std::hex << std::setw(4) << offset;
                 if (is_union) {
                     os << "_" << std::dec << j;
@@ -363,7 +349,7 @@ void Struc::print(std::ostream &os) const
             else {
                 os << indent << "struct { char _padding[0x" << std::hex
                    << std::setw(4) << offset - base_offset << "]; "
-                   << field.type_to_string() << " value";
+                   << field.type_to_string(namer) << " value";
                 if (field.count() > 1) {
                     os << '[' << std::dec << field.count() << ']';
                 }
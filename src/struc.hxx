@@ -1,16 +1,24 @@
 #pragma once
 
+#include <algorithm>
 #include <functional>
 #include <iosfwd>
-#include <map>
-#include <mutex>
-#include <set>
 #include <string>
+#include <utility>
+#include <vector>
 
 namespace rstc {
 
+    // Not thread-safe. A struc is only modified by the task which owns it:
+    // the analysis of the flo which creates it, then the merging of its
+    // class of linked strucs. Afterwards it is read-only.
     class Struc {
     public:
+        // Dense index of the struc in its `Restruc`
+        using Id = size_t;
+        // Names are only generated when strucs are printed
+        using Namer = std::function<std::string(Struc const &)>;
+
         class Field {
         public:
             friend class Struc;
@@ -50,7 +58,7 @@ namespace rstc {
                        && rhs.count_ && struc_ == rhs.struc_;
             }
 
-            std::string type_to_string() const;
+            std::string type_to_string(Namer const &namer) const;
 
         private:
             Field(Type type,
@@ -65,10 +73,10 @@ namespace rstc {
             Type type_;
         };
 
-        using MergeCallback =
-            std::function<void(Struc const &dst, Struc const &src)>;
+        // Sorted by offset, fields at the same offset in insertion order
+        using Fields = std::vector<std::pair<size_t, Field>>;
 
-        Struc(std::string name);
+        explicit Struc(Id id);
 
         void add_int_field(size_t offset,
                            size_t size,
@@ -80,30 +88,49 @@ namespace rstc {
                                Struc const *struc = nullptr);
         void
         add_struc_field(size_t offset, Struc const *struc, size_t count = 1);
-        void merge(Struc const &src, MergeCallback merge_callback);
-        bool try_merge_struc_field_at_offset(size_t offset,
-                                             Field const &src_field,
-                                             MergeCallback merge_callback);
+        // Merges fields of `src`, pointers keep their strucs
+        void merge(Struc const &src);
         void merge_fields(size_t offset, Field const &field);
+        // Replaces strucs of pointer and struc fields
+        void redirect_strucs(
+            std::function<Struc const *(Struc const *)> const &redirect);
 
-        inline std::string const &name() const { return name_; }
+        inline Id id() const { return id_; }
+        inline void set_id(Id id) { id_ = id; }
 
         size_t get_size() const;
-        bool has_field_at_offset(size_t offset);
+        inline bool has_struc_fields() const { return struc_fields_count_; }
+        bool has_field_at_offset(size_t offset) const;
+
+        inline Fields const &fields() const { return fields_; }
 
-        inline std::multimap<size_t, Field> const &fields() const
+        // Visits fields which cover `offset`, starting from the last one
+        // at or before it, until `visit` returns true
+        template<typename Visit>
+        bool visit_fields_at(size_t offset, Visit &&visit) const
         {
-            return fields_;
+            auto it = std::upper_bound(
+                fields_.begin(),
+                fields_.end(),
+                offset,
+                [](size_t offset, auto const &entry) {
+                    return offset < entry.first;
+                });
+            // Nothing before `i` reaches past `max_ends_[i]`
+            for (size_t i = std::distance(fields_.begin(), it);
+                 i-- > 0 && max_ends_[i] > offset;) {
+                auto const &[field_offset, field] = fields_[i];
+                if (field_offset + field.count() * field.size() > offset
+                    && visit(field_offset, field)) {
+                    return true;
+                }
+            }
+            return false;
         }
 
         static constexpr Struc *Atomic = nullptr;
 
-        void print(std::ostream &os) const;
-
-        inline std::recursive_mutex &mutex() const
-        {
-            return modify_access_mutex_;
-        }
+        void print(std::ostream &os, Namer const &namer) const;
 
     private:
         void add_field(size_t offset, Field field);
@@ -114,12 +141,18 @@ namespace rstc {
         size_t remove_aliases(size_t offset,
                               bool (Field::*alias_check)(size_t size) const,
                               size_t size);
-
-        std::string name_;
-        std::multimap<size_t, Field> fields_;
-        std::set<size_t> field_set_;
-
-        std::recursive_mutex mutable modify_access_mutex_;
+        std::pair<size_t, size_t> equal_range(size_t offset) const;
+        // Rebuilds the index and the size after fields from `first` changed
+        void update_index(size_t first);
+        size_t compute_size() const;
+
+        Id id_;
+        Fields fields_;
+        // Interval index: the largest end among fields up to each one,
+        // struc fields might grow, so they reach to the end
+        std::vector<size_t> max_ends_;
+        size_t size_ = 0;
+        size_t struc_fields_count_ = 0;
     };
 
 }
@@ -0,0 +1,110 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace rstc::utils {
+
+    // Bump allocator for trivially destructible objects.
+    // Memory is released all at once, when the arena is destroyed.
+    // Not thread-safe.
+    class Arena {
+    public:
+        explicit Arena(size_t initial_block_size = 4 * 1024,
+                       size_t max_block_size = 64 * 1024)
+            : block_size_(initial_block_size)
+            , max_block_size_(max_block_size)
+        {
+        }
+
+        Arena(Arena const &) = delete;
+        Arena &operator=(Arena const &) = delete;
+
+        // The moved-from arena owns no blocks, so it mustn't keep
+        // allocating from the current one
+        Arena(Arena &&other) noexcept
+            : block_size_(other.block_size_)
+            , max_block_size_(other.max_block_size_)
+            , blocks_(std::move(other.blocks_))
+            , current_(std::exchange(other.current_, nullptr))
+            , end_(std::exchange(other.end_, nullptr))
+        {
+        }
+
+        Arena &operator=(Arena &&other) noexcept
+        {
+            if (this != &other) {
+                block_size_ = other.block_size_;
+                max_block_size_ = other.max_block_size_;
+                blocks_ = std::move(other.blocks_);
+                current_ = std::exchange(other.current_, nullptr);
+                end_ = std::exchange(other.end_, nullptr);
+            }
+            return *this;
+        }
+
+        void *allocate(size_t size, size_t alignment)
+        {
+            if (auto current = align(current_, alignment);
+                current_ && current + size <= end_) {
+                current_ = current + size;
+                return current;
+            }
+            // Oversized allocations get a dedicated block,
+            // the current block is kept for the following allocations.
+            if (size + alignment > block_size_) {
+                blocks_.push_back(
+                    std::make_unique<std::byte[]>(size + alignment));
+                return align(blocks_.back().get(), alignment);
+            }
+            new_block();
+            auto current = align(current_, alignment);
+            current_ = current + size;
+            return current;
+        }
+
+        template<typename T, typename... Args>
+        T *make(Args &&...args)
+        {
+            static_assert(std::is_trivially_destructible_v<T>);
+            return new (allocate(sizeof(T), alignof(T)))
+                T(std::forward<Args>(args)...);
+        }
+
+        template<typename T>
+        T *make_array(size_t count)
+        {
+            static_assert(std::is_trivially_destructible_v<T>);
+            return new (allocate(sizeof(T) * count, alignof(T))) T[count]();
+        }
+
+    private:
+        static std::byte *align(std::byte *pointer, size_t alignment)
+        {
+            auto value = reinterpret_cast<uintptr_t>(pointer);
+            value = (value + alignment - 1) & ~(alignment - 1);
+            return reinterpret_cast<std::byte *>(value);
+        }
+
+        void new_block()
+        {
+            blocks_.push_back(std::make_unique<std::byte[]>(block_size_));
+            current_ = blocks_.back().get();
+            end_ = current_ + block_size_;
+            block_size_ = std::min(block_size_ * 2, max_block_size_);
+        }
+
+        size_t block_size_;
+        size_t max_block_size_;
+        std::vector<std::unique_ptr<std::byte[]>> blocks_;
+        std::byte *current_ = nullptr;
+        std::byte *end_ = nullptr;
+    };
+
+}
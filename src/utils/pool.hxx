@@ -0,0 +1,79 @@
+#pragma once
+
+#include "arena.hxx"
+
+#include <algorithm>
+#include <cstddef>
+#include <new>
+#include <utility>
+#include <vector>
+
+namespace rstc::utils {
+
+    // Arena with free lists per size class, for small objects which
+    // are freed and reallocated often. Memory is returned to the system
+    // all at once, when the pool is destroyed.
+    // Not thread-safe.
+    class Pool {
+    public:
+        Pool() = default;
+
+        Pool(Pool const &) = delete;
+        Pool(Pool &&) = default;
+        Pool &operator=(Pool const &) = delete;
+        Pool &operator=(Pool &&) = default;
+
+        void *allocate(size_t size)
+        {
+            size_t size_class = get_size_class(size);
+            if (size_class < free_lists_.size()) {
+                if (auto node = free_lists_[size_class]; node) {
+                    free_lists_[size_class] = node->next;
+                    return node;
+                }
+            }
+            return arena_.allocate((size_class + 1) * granularity_,
+                                   granularity_);
+        }
+
+        void deallocate(void *pointer, size_t size)
+        {
+            size_t size_class = get_size_class(size);
+            if (size_class >= free_lists_.size()) {
+                free_lists_.resize(size_class + 1, nullptr);
+            }
+            auto node = static_cast<FreeNode *>(pointer);
+            node->next = free_lists_[size_class];
+            free_lists_[size_class] = node;
+        }
+
+        template<typename T, typename... Args>
+        T *make(Args &&...args)
+        {
+            return new (allocate(sizeof(T))) T(std::forward<Args>(args)...);
+        }
+
+        template<typename T>
+        void destroy(T *pointer)
+        {
+            pointer->~T();
+            deallocate(pointer, sizeof(T));
+        }
+
+    private:
+        struct FreeNode {
+            FreeNode *next;
+        };
+
+        static constexpr size_t granularity_ = 16;
+
+        static size_t get_size_class(size_t size)
+        {
+            return (std::max(size, sizeof(FreeNode)) - 1) / granularity_;
+        }
+
+        Arena arena_;
+        std::vector<FreeNode *> free_lists_;
+    };
+
+}
@@ -3,7 +3,7 @@
 #include "utils/hash.hxx"
 
 #include <algorithm>
-#include <iterator>
+#include <new>
 
 using namespace rstc;
 using namespace rstc::virt;
@@ -57,193 +57,266 @@ Memory::Values::operator Value() const
     return make_value(source, value);
 }
 
-Memory::Memory(std::nullptr_t)
+Memory::Memory(std::nullptr_t, utils::Pool *pool)
     : default_source_(nullptr)
-    , holder_(std::make_shared<Holder>())
+    , pool_(pool)
+    , root_(make_node<Branch>())
 {
 }
 
 Memory::Memory(Memory const *parent)
     : default_source_(parent->default_source_)
-    , holder_(parent->holder_)
+    , pool_(parent->pool_)
+    , root_(parent->root_)
 {
+    root_->references++;
+}
+
+Memory::Memory(Memory const &other, utils::Pool *pool)
+    : default_source_(other.default_source_)
+    , pool_(pool)
+    , root_(static_cast<Branch *>(copy(other.root_, 0)))
+{
+}
+
+Memory::~Memory()
+{
+    release(root_, 0);
+}
+
+Memory::Memory(Memory &&other) noexcept
+    : default_source_(other.default_source_)
+    , pool_(other.pool_)
+    , root_(other.root_)
+{
+    other.root_ = nullptr;
+}
+
+Memory &Memory::operator=(Memory &&rhs) noexcept
+{
+    std::swap(default_source_, rhs.default_source_);
+    std::swap(pool_, rhs.pool_);
+    std::swap(root_, rhs.root_);
+    return *this;
 }
 
 void Memory::set(uintptr_t address, Value const &value)
 {
-    std::vector<Value> values;
-    values.reserve(value.size());
+    Page *page = nullptr;
+    uintptr_t page_address = 0;
+    auto set_byte = [&](uintptr_t byte_address, Value const &byte) {
+        if (!page || (byte_address & ~(page_size_ - 1)) != page_address) {
+            page_address = byte_address & ~(page_size_ - 1);
+            page = &modify_page(page_address);
+        }
+        page->set(byte_address & (page_size_ - 1), byte);
+    };
     if (!value.is_symbolic()) {
         auto raw_value = value.value();
-        std::transform(reinterpret_cast<Byte *>(&raw_value),
-                       reinterpret_cast<Byte *>(&raw_value) + value.size(),
-                       std::back_inserter(values),
-                       [source = value.source()](Byte b) {
-                           return make_value(source, b, 1);
-                       });
+        for (int i = 0; i < value.size(); i++) {
+            set_byte(address + i,
+                     make_value(value.source(),
+                                reinterpret_cast<Byte *>(&raw_value)[i],
+                                1));
+        }
     }
     else {
         uintptr_t id = value.symbol().id();
         utils::hash::combine(id, value.symbol().offset());
-        for (size_t i = 0; i < value.size(); i++) {
+        for (int i = 0; i < value.size(); i++) {
             utils::hash::combine(id, address);
-            values.push_back(make_symbolic_value(value.source(),
-                                                 1,
-                                                 value.symbol().offset(),
-                                                 id));
+            set_byte(address + i,
+                     make_symbolic_value(value.source(),
+                                         1,
+                                         value.symbol().offset(),
+                                         id));
         }
     }
-    set(address, values);
 }
 
 void Memory::set(uintptr_t address, std::vector<Value> const &values)
 {
-    if (values.empty()) {
-        return;
-    }
-    auto tree = std::static_pointer_cast<Holder>(holder_);
-    auto new_tree = std::make_shared<Holder>();
-    holder_ = new_tree;
-    uintptr_t begin = 0;
-    uintptr_t end = ~0;
-    uintptr_t address_end = address + values.size();
-    while (begin < end - 3) {
-        uintptr_t middle = begin + (end - begin) / 2;
-        if (address < middle && address_end < middle) {
-            end = middle;
-            new_tree->l = std::make_shared<Holder>();
-            if (tree) {
-                new_tree->r = tree->r;
-                tree = std::static_pointer_cast<Holder>(tree->l);
-            }
-            new_tree = std::static_pointer_cast<Holder>(new_tree->l);
+    size_t i = 0;
+    while (i < values.size()) {
+        // Aligned accesses stay within a single page
+        uintptr_t byte_address = address + i;
+        auto &page = modify_page(byte_address);
+        for (size_t offset = byte_address & (page_size_ - 1);
+             offset < page_size_ && i < values.size();
+             offset++, i++) {
+            page.set(offset, values[i]);
         }
-        else if (address >= middle && address_end >= middle) {
-            begin = middle;
-            new_tree->r = std::make_shared<Holder>();
-            if (tree) {
-                new_tree->l = tree->l;
-                tree = std::static_pointer_cast<Holder>(tree->r);
+    }
+}
+
+Memory::Values Memory::get(uintptr_t address, size_t size) const
+{
+    Values values(address, size, default_source_);
+    size_t i = 0;
+    while (i < size) {
+        uintptr_t byte_address = address + i;
+        size_t offset = byte_address & (page_size_ - 1);
+        size_t count = std::min(page_size_ - offset, size - i);
+        if (auto page = find_page(byte_address); page) {
+            for (size_t j = 0; j < count; j++) {
+                if (page->present & (1 << (offset + j))) {
+                    values.container[i + j] = page->values()[offset + j];
+                }
             }
-            new_tree = std::static_pointer_cast<Holder>(new_tree->r);
-        }
-        else {
-            break;
         }
+        i += count;
     }
-    for (uintptr_t i = address; i != address_end; i++) {
-        auto const &value = values[i - address];
-        set_value(tree, new_tree, begin, end, i, value);
-        tree = new_tree;
+    return values;
+}
+
+Memory::Page const *Memory::find_page(uintptr_t address) const
+{
+    Node const *node = root_;
+    for (unsigned level = 0; level < depth_ && node; level++) {
+        node = static_cast<Branch const *>(node)
+                   ->children[child_index(address, level)];
     }
+    return static_cast<Page const *>(node);
 }
 
-void Memory::set_value(std::shared_ptr<Holder> tree,
-                       std::shared_ptr<Holder> new_tree,
-                       uintptr_t begin,
-                       uintptr_t end,
-                       uintptr_t address,
-                       Value const &value)
+Memory::Page &Memory::modify_page(uintptr_t address)
 {
-    while (true) {
-        uintptr_t middle = begin + (end - begin) / 2;
-        if (address < middle) {
-            end = middle;
-            if (tree) {
-                new_tree->r = tree->r;
+    if (root_->references > 1) {
+        auto copy = make_node<Branch>(*root_);
+        copy->references = 1;
+        for (auto child : copy->children) {
+            if (child) {
+                child->references++;
             }
-            if (begin < end - 1) {
-                if (tree) {
-                    tree = std::static_pointer_cast<Holder>(tree->l);
-                }
-                new_tree->l = std::make_shared<Holder>();
-                new_tree = std::static_pointer_cast<Holder>(new_tree->l);
+        }
+        release(root_, 0);
+        root_ = copy;
+    }
+    Branch *branch = root_;
+    for (unsigned level = 0;; level++) {
+        auto &child = branch->children[child_index(address, level)];
+        bool is_page = level + 1 == depth_;
+        if (!child) {
+            if (is_page) {
+                child = make_node<Page>();
             }
             else {
-                new_tree->l = std::make_shared<Value>(value);
-                break;
+                child = make_node<Branch>();
             }
         }
-        else {
-            begin = middle;
-            if (tree) {
-                new_tree->l = tree->l;
-            }
-            if (begin < end - 1) {
-                if (tree) {
-                    tree = std::static_pointer_cast<Holder>(tree->r);
-                }
-                new_tree->r = std::make_shared<Holder>();
-                new_tree = std::static_pointer_cast<Holder>(new_tree->r);
+        else if (child->references > 1) {
+            Node *copy;
+            if (is_page) {
+                copy = make_node<Page>(*static_cast<Page *>(child));
             }
             else {
-                new_tree->r = std::make_shared<Value>(value);
-                break;
+                auto branch_copy =
+                    make_node<Branch>(*static_cast<Branch *>(child));
+                for (auto grandchild : branch_copy->children) {
+                    if (grandchild) {
+                        grandchild->references++;
+                    }
+                }
+                copy = branch_copy;
             }
+            copy->references = 1;
+            release(child, level + 1);
+            child = copy;
         }
+        if (is_page) {
+            return *static_cast<Page *>(child);
+        }
+        branch = static_cast<Branch *>(child);
     }
 }
 
-Memory::Values Memory::get(uintptr_t address, size_t size) const
+template<typename T, typename... Args>
+T *Memory::make_node(Args &&...args)
 {
-    Values values(address, size, default_source_);
-    auto tree = std::static_pointer_cast<Holder>(holder_);
-    uintptr_t begin = 0;
-    uintptr_t end = ~0;
-    uintptr_t address_end = address + size;
-    while (tree) {
-        uintptr_t middle = begin + (end - begin) / 2;
-        if (address < middle && address_end < middle) {
-            end = middle;
-            tree = std::static_pointer_cast<Holder>(tree->l);
-        }
-        else if (address >= middle && address_end >= middle) {
-            begin = middle;
-            tree = std::static_pointer_cast<Holder>(tree->r);
-        }
-        else {
-            break;
-        }
+    if (pool_) {
+        return pool_->make<T>(std::forward<Args>(args)...);
     }
-    if (tree) {
-        for (uintptr_t i = address; i != address_end; i++) {
-            values.container[i - address] = get_value(tree, begin, end, i);
-        }
+    return new T(std::forward<Args>(args)...);
+}
+
+template<typename T>
+void Memory::destroy_node(T *node)
+{
+    if (pool_) {
+        pool_->destroy(node);
+    }
+    else {
+        delete node;
     }
-    return values;
 }
 
-Value Memory::get_value(std::shared_ptr<Holder> tree,
-                        uintptr_t begin,
-                        uintptr_t end,
-                        uintptr_t address) const
+unsigned Memory::child_index(uintptr_t address, unsigned level)
 {
-    std::shared_ptr<void> value = nullptr;
-    while (tree) {
-        uintptr_t middle = begin + (end - begin) / 2;
-        if (address < middle) {
-            end = middle;
-            if (begin < end - 1) {
-                tree = std::static_pointer_cast<Holder>(tree->l);
-            }
-            else {
-                value = tree->l;
-                break;
-            }
+    unsigned shift = page_bits_ + (depth_ - level - 1) * fanout_bits_;
+    return (address >> shift) & (fanout_ - 1);
+}
+
+void Memory::release(Node *node, unsigned level)
+{
+    if (!node || --node->references > 0) {
+        return;
+    }
+    if (level == depth_) {
+        destroy_node(static_cast<Page *>(node));
+        return;
+    }
+    auto branch = static_cast<Branch *>(node);
+    for (auto child : branch->children) {
+        release(child, level + 1);
+    }
+    destroy_node(branch);
+}
+
+Memory::Node *Memory::copy(Node const *node, unsigned level)
+{
+    if (!node) {
+        return nullptr;
+    }
+    if (level == depth_) {
+        auto page = make_node<Page>(*static_cast<Page const *>(node));
+        page->references = 1;
+        return page;
+    }
+    auto branch = make_node<Branch>();
+    auto const &children = static_cast<Branch const *>(node)->children;
+    for (size_t i = 0; i < fanout_; i++) {
+        branch->children[i] = copy(children[i], level + 1);
+    }
+    return branch;
+}
+
+Memory::Page::Page(Page const &other)
+    : Node(other)
+    , present(other.present)
+{
+    for (size_t i = 0; i < page_size_; i++) {
+        if (present & (1 << i)) {
+            new (&values()[i]) Value(other.values()[i]);
         }
-        else if (address >= middle) {
-            begin = middle;
-            if (begin < end - 1) {
-                tree = std::static_pointer_cast<Holder>(tree->r);
-            }
-            else {
-                value = tree->r;
-                break;
-            }
+    }
+}
+
+Memory::Page::~Page()
+{
+    for (size_t i = 0; i < page_size_; i++) {
+        if (present & (1 << i)) {
+            values()[i].~Value();
         }
     }
-    if (value) {
-        return *std::static_pointer_cast<Value>(value);
+}
+
+void Memory::Page::set(size_t offset, Value const &value)
+{
+    if (present & (1 << offset)) {
+        values()[offset] = value;
+    }
+    else {
+        new (&values()[offset]) Value(value);
+        present |= 1 << offset;
     }
-    return make_symbolic_value(default_source_, 1);
 }
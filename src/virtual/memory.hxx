@@ -5,7 +5,11 @@
 #include "registers.hxx"
 #include "value.hxx"
 
-#include <map>
+#include "utils/pool.hxx"
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
 #include <vector>
 
 namespace rstc::virt {
@@ -21,39 +25,82 @@ namespace rstc::virt {
             operator Value() const;
         };
 
-        Memory(std::nullptr_t);
+        // Children allocate from the parent's pool,
+        // a root without a pool allocates from the heap
+        Memory(std::nullptr_t, utils::Pool *pool = nullptr);
         Memory(Memory const *parent);
+        // Deep copy allocated from `pool`, shares nothing with `other`
+        Memory(Memory const &other, utils::Pool *pool);
+        ~Memory();
 
         Memory(Memory const &) = delete;
-        Memory(Memory &&other) = default;
+        Memory(Memory &&other) noexcept;
 
         Memory &operator=(Memory const &) = delete;
-        Memory &operator=(Memory &&rhs) = default;
+        Memory &operator=(Memory &&rhs) noexcept;
 
         void set(uintptr_t address, Value const &value);
         void set(uintptr_t address, std::vector<Value> const &values);
         Values get(uintptr_t address, size_t size) const;
 
     private:
-        struct Holder {
-            std::shared_ptr<void> l = nullptr;
-            std::shared_ptr<void> r = nullptr;
+        // Persistent 16-way radix trie over the address space, its leaves
+        // are pages of byte values. Nodes are shared with children and
+        // copied on the first write, exclusively owned nodes are modified
+        // in place. Reference counting isn't atomic: a context and
+        // its children are confined to the analyzing thread.
+        static constexpr unsigned page_bits_ = 4;
+        static constexpr unsigned fanout_bits_ = 4;
+        static constexpr size_t page_size_ = size_t(1) << page_bits_;
+        static constexpr size_t fanout_ = size_t(1) << fanout_bits_;
+        static constexpr unsigned depth_ =
+            (sizeof(uintptr_t) * 8 - page_bits_) / fanout_bits_;
+
+        struct Node {
+            size_t references = 1;
+        };
+
+        struct Branch : Node {
+            std::array<Node *, fanout_> children{};
         };
 
-        void set_value(std::shared_ptr<Holder> tree,
-                       std::shared_ptr<Holder> new_tree,
-                       uintptr_t begin,
-                       uintptr_t end,
-                       uintptr_t address,
-                       Value const &value);
+        struct Page : Node {
+            // Bit per byte which was written
+            uint16_t present = 0;
+            alignas(Value) std::byte storage[page_size_ * sizeof(Value)];
+
+            Page() = default;
+            Page(Page const &other);
+            ~Page();
+
+            inline Value *values()
+            {
+                return reinterpret_cast<Value *>(storage);
+            }
+            inline Value const *values() const
+            {
+                return reinterpret_cast<Value const *>(storage);
+            }
+            void set(size_t offset, Value const &value);
+        };
+
+        static_assert(page_size_ <= sizeof(Page::present) * 8);
+
+        Page const *find_page(uintptr_t address) const;
+        Page &modify_page(uintptr_t address);
+
+        template<typename T, typename... Args>
+        T *make_node(Args &&...args);
+        template<typename T>
+        void destroy_node(T *node);
+        void release(Node *node, unsigned level);
+        Node *copy(Node const *node, unsigned level);
 
-        Value get_value(std::shared_ptr<Holder> tree,
-                        uintptr_t begin,
-                        uintptr_t end,
-                        uintptr_t address) const;
+        static unsigned child_index(uintptr_t address, unsigned level);
 
         Address default_source_;
-        std::shared_ptr<void> holder_;
+        utils::Pool *pool_;
+        Branch *root_;
     };
 
 }
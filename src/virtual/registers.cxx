@@ -1,5 +1,8 @@
 #include "registers.hxx"
 
+#include <memory>
+#include <new>
+
 using namespace rstc;
 using namespace rstc::virt;
 
@@ -201,49 +204,98 @@ const std::unordered_set<ZydisRegister> Registers::legacy_ho_part_{
     ZYDIS_REGISTER_BH,
 };
 
-Registers::Registers(Registers const *parent)
-    : holder_(parent ? parent->holder_ : std::make_shared<Holder>())
+const std::array<Registers::ChunkIndex, Registers::REGISTERS_COUNT>
+    Registers::chunk_index_ = [] {
+        std::array<ChunkIndex, REGISTERS_COUNT> chunk_index;
+        for (size_t i = 0; i < CHUNKS_COUNT; i++) {
+            for (size_t reg = chunk_bounds_[i]; reg < chunk_bounds_[i + 1];
+                 reg++) {
+                chunk_index[reg] = static_cast<ChunkIndex>(i);
+            }
+        }
+        return chunk_index;
+    }();
+
+const std::array<Registers::Reg, Registers::REGISTERS_COUNT>
+    Registers::chunk_begin_ = [] {
+        std::array<Reg, REGISTERS_COUNT> chunk_begin;
+        for (size_t reg = 0; reg < REGISTERS_COUNT; reg++) {
+            chunk_begin[reg] = chunk_bounds_[chunk_index_[reg]];
+        }
+        return chunk_begin;
+    }();
+
+const std::array<Registers::Reg, ZYDIS_REGISTER_MAX_VALUE + 1>
+    Registers::lookup_ = [] {
+        std::array<Reg, ZYDIS_REGISTER_MAX_VALUE + 1> lookup;
+        lookup.fill(REGISTERS_COUNT);
+        for (size_t i = 0; i < lookup.size(); i++) {
+            auto zydis_reg = promote(static_cast<ZydisRegister>(i));
+            if (auto it = register_map.find(zydis_reg);
+                it != register_map.end()) {
+                lookup[i] = it->second;
+            }
+        }
+        return lookup;
+    }();
+
+const std::array<ZydisRegister, Registers::REGISTERS_COUNT>
+    Registers::zydis_ = [] {
+        std::array<ZydisRegister, REGISTERS_COUNT> zydis{};
+        for (auto const &[zydis_reg, reg] : register_map) {
+            zydis[reg] = zydis_reg;
+        }
+        return zydis;
+    }();
+
+Registers::Registers(Registers const *parent, utils::Pool *pool)
+    : pool_(parent ? parent->pool_ : pool)
 {
-    if (parent == nullptr) {
-        initialize_holder(*std::static_pointer_cast<Holder>(holder_),
-                          0,
-                          REGISTERS_COUNT);
+    if (parent) {
+        chunks_ = parent->chunks_;
+        for (auto chunk : chunks_) {
+            chunk->references++;
+        }
+        return;
+    }
+    for (size_t i = 0; i < CHUNKS_COUNT; i++) {
+        chunks_[i] = Chunk::make(pool_, chunk_bounds_[i + 1] - chunk_bounds_[i]);
     }
 }
 
-std::optional<Value> Registers::get(ZydisRegister zydis_reg) const
+Registers::Registers(Registers const &other, utils::Pool *pool)
+    : pool_(pool)
 {
-    zydis_reg = promote(zydis_reg);
-    Reg reg;
-    if (auto it = register_map.find(zydis_reg); it != register_map.end()) {
-        reg = it->second;
+    for (size_t i = 0; i < CHUNKS_COUNT; i++) {
+        chunks_[i] = Chunk::copy(pool_, *other.chunks_[i]);
     }
-    else {
-        return std::nullopt;
+}
+
+Registers::~Registers()
+{
+    for (auto chunk : chunks_) {
+        Chunk::release(pool_, chunk);
     }
-    auto tree = std::static_pointer_cast<Holder>(holder_);
-    size_t begin = 0;
-    size_t end = REGISTERS_COUNT;
-    while (true) {
-        size_t middle = begin + (end - begin) / 2;
-        if (reg < middle) {
-            end = middle;
-            if (begin < end - 1) {
-                tree = std::static_pointer_cast<Holder>(tree->l);
-            }
-            else {
-                return *std::static_pointer_cast<Value>(tree->l);
-            }
-        }
-        else {
-            begin = middle;
-            if (begin < end - 1) {
-                tree = std::static_pointer_cast<Holder>(tree->r);
-            }
-            else {
-                return *std::static_pointer_cast<Value>(tree->r);
-            }
-        }
+}
+
+Registers::Registers(Registers &&other) noexcept
+    : pool_(other.pool_)
+    , chunks_(other.chunks_)
+{
+    other.chunks_.fill(nullptr);
+}
+
+Registers &Registers::operator=(Registers &&rhs) noexcept
+{
+    std::swap(pool_, rhs.pool_);
+    std::swap(chunks_, rhs.chunks_);
+    return *this;
+}
+
+std::optional<Value> Registers::get(ZydisRegister zydis_reg) const
+{
+    if (auto reg = lookup(zydis_reg); reg) {
+        return value_at(*reg);
     }
     return std::nullopt;
 }
@@ -251,12 +303,8 @@ std::optional<Value> Registers::get(ZydisRegister zydis_reg) const
 // TODO: use register size
 void Registers::set(ZydisRegister zydis_reg, Value value)
 {
-    zydis_reg = promote(zydis_reg);
-    Reg reg;
-    if (auto it = register_map.find(zydis_reg); it != register_map.end()) {
-        reg = it->second;
-    }
-    else {
+    auto reg = lookup(zydis_reg);
+    if (!reg) {
         return;
     }
     if (!value.is_symbolic()) {
@@ -265,17 +313,17 @@ void Registers::set(ZydisRegister zydis_reg, Value value)
         case 8:
         case 4: break;
         case 2:
-            if (auto orig_value = get(zydis_reg);
-                orig_value && !orig_value->is_symbolic()) {
-                auto new_value = (orig_value->value() & 0xFFFFFFFFFFFF0000)
+            if (auto const &orig_value = value_at(*reg);
+                !orig_value.is_symbolic()) {
+                auto new_value = (orig_value.value() & 0xFFFFFFFFFFFF0000)
                                  | (value.value() & 0xFFFF);
                 value = Value(value.source(), new_value);
             }
             break;
         case 1:
-            if (auto orig_value = get(zydis_reg);
-                orig_value && !orig_value->is_symbolic()) {
-                auto new_value = orig_value->value();
+            if (auto const &orig_value = value_at(*reg);
+                !orig_value.is_symbolic()) {
+                auto new_value = orig_value.value();
                 if (!legacy_ho_part_.contains(zydis_reg)) {
                     new_value = (new_value & 0xFFFFFFFFFFFFFF00)
                                 | (value.value() & 0xFF);
@@ -289,55 +337,22 @@ void Registers::set(ZydisRegister zydis_reg, Value value)
             break;
         }
     }
-    auto tree = std::static_pointer_cast<Holder>(holder_);
-    auto new_tree = std::make_shared<Holder>();
-    holder_ = new_tree;
-    size_t begin = 0;
-    size_t end = REGISTERS_COUNT;
-    while (true) {
-        size_t middle = begin + (end - begin) / 2;
-        if (reg < middle) {
-            end = middle;
-            new_tree->r = tree->r;
-            if (begin < end - 1) {
-                new_tree->l = std::make_shared<Holder>();
-                new_tree = std::static_pointer_cast<Holder>(new_tree->l);
-                tree = std::static_pointer_cast<Holder>(tree->l);
-            }
-            else {
-                new_tree->l = std::make_shared<Value>(std::move(value));
-                break;
-            }
-        }
-        else {
-            begin = middle;
-            new_tree->l = tree->l;
-            if (begin < end - 1) {
-                new_tree->r = std::make_shared<Holder>();
-                new_tree = std::static_pointer_cast<Holder>(new_tree->r);
-                tree = std::static_pointer_cast<Holder>(tree->r);
-            }
-            else {
-                new_tree->r = std::make_shared<Value>(std::move(value));
-                break;
-            }
-        }
-    }
+    modify(*reg) = std::move(value);
 }
 
 bool Registers::is_tracked(ZydisRegister zydis_reg) const
 {
-    zydis_reg = promote(zydis_reg);
-    return register_map.contains(zydis_reg);
+    return lookup(zydis_reg).has_value();
 }
 
 std::optional<Registers::Reg> Registers::from_zydis(ZydisRegister zydis_reg)
 {
-    zydis_reg = promote(zydis_reg);
-    if (auto it = register_map.find(zydis_reg); it != register_map.end()) {
-        return it->second;
-    }
-    return std::nullopt;
+    return lookup(zydis_reg);
+}
+
+ZydisRegister Registers::to_zydis(Reg reg)
+{
+    return zydis_[reg];
 }
 
 ZydisRegister Registers::promote(ZydisRegister zydis_reg)
@@ -349,23 +364,59 @@ ZydisRegister Registers::promote(ZydisRegister zydis_reg)
     return zydis_reg;
 }
 
-void Registers::initialize_holder(Holder &holder, size_t begin, size_t end)
+std::optional<Registers::Reg> Registers::lookup(ZydisRegister zydis_reg)
 {
-    auto middle = begin + (end - begin) / 2;
-    if (begin < middle - 1) {
-        auto l = std::make_shared<Holder>();
-        holder.l = l;
-        initialize_holder(*l, begin, middle);
+    if (static_cast<size_t>(zydis_reg) < lookup_.size()) {
+        if (auto reg = lookup_[zydis_reg]; reg != REGISTERS_COUNT) {
+            return reg;
+        }
     }
-    else {
-        holder.l = std::make_shared<Value>();
+    return std::nullopt;
+}
+
+Value &Registers::modify(Reg reg)
+{
+    auto &chunk = chunks_[chunk_index_[reg]];
+    if (chunk->references > 1) {
+        auto copy = Chunk::copy(pool_, *chunk);
+        Chunk::release(pool_, chunk);
+        chunk = copy;
+    }
+    return chunk->values()[reg - chunk_begin_[reg]];
+}
+
+Registers::Chunk *Registers::Chunk::make(utils::Pool *pool, size_t size)
+{
+    size_t bytes = sizeof(Chunk) + size * sizeof(Value);
+    auto chunk = static_cast<Chunk *>(pool ? pool->allocate(bytes)
+                                           : ::operator new(bytes));
+    chunk->references = 1;
+    chunk->size = size;
+    std::uninitialized_default_construct_n(chunk->values(), size);
+    return chunk;
+}
+
+Registers::Chunk *Registers::Chunk::copy(utils::Pool *pool, Chunk const &chunk)
+{
+    size_t bytes = sizeof(Chunk) + chunk.size * sizeof(Value);
+    auto copy = static_cast<Chunk *>(pool ? pool->allocate(bytes)
+                                          : ::operator new(bytes));
+    copy->references = 1;
+    copy->size = chunk.size;
+    std::uninitialized_copy_n(chunk.values(), chunk.size, copy->values());
+    return copy;
+}
+
+void Registers::Chunk::release(utils::Pool *pool, Chunk *chunk)
+{
+    if (!chunk || --chunk->references > 0) {
+        return;
     }
-    if (middle < end - 1) {
-        auto r = std::make_shared<Holder>();
-        holder.r = r;
-        initialize_holder(*r, middle, end);
+    std::destroy_n(chunk->values(), chunk->size);
+    if (pool) {
+        pool->deallocate(chunk, sizeof(Chunk) + chunk->size * sizeof(Value));
     }
     else {
-        holder.r = std::make_shared<Value>();
+        ::operator delete(chunk);
     }
 }
@@ -4,9 +4,11 @@
 
 #include "value.hxx"
 
+#include "utils/pool.hxx"
+
 #include <Zydis/Zydis.h>
 
-#include <memory>
+#include <array>
 #include <optional>
 #include <unordered_map>
 #include <unordered_set>
@@ -80,13 +82,19 @@ namespace rstc::virt {
             REGISTERS_COUNT,
         };
 
-        Registers(Registers const *parent = nullptr);
+        // Children allocate from the parent's pool,
+        // a root without a pool allocates from the heap
+        Registers(Registers const *parent = nullptr,
+                  utils::Pool *pool = nullptr);
+        // Deep copy allocated from `pool`, shares nothing with `other`
+        Registers(Registers const &other, utils::Pool *pool);
+        ~Registers();
 
         Registers(Registers const &) = delete;
-        Registers(Registers &&other) = default;
+        Registers(Registers &&other) noexcept;
 
         Registers &operator=(Registers const &) = delete;
-        Registers &operator=(Registers &&rhs) = default;
+        Registers &operator=(Registers &&rhs) noexcept;
 
         std::optional<Value> get(ZydisRegister zydis_reg) const;
         void set(ZydisRegister zydis_reg, Value value);
@@ -94,21 +102,69 @@ namespace rstc::virt {
         bool is_tracked(ZydisRegister zydis_reg) const;
 
         static std::optional<Reg> from_zydis(ZydisRegister zydis_reg);
+        // Full-size Zydis register of `reg`
+        static ZydisRegister to_zydis(Reg reg);
         static ZydisRegister promote(ZydisRegister zydis_reg);
 
         static const std::unordered_map<ZydisRegister, Registers::Reg>
             register_map;
 
     private:
-        struct Holder {
-            std::shared_ptr<void> l = nullptr;
-            std::shared_ptr<void> r = nullptr;
+        // Registers are split into chunks which are shared with children
+        // and copied on the first write. Reference counting isn't atomic:
+        // a context and its children are confined to the analyzing thread.
+        enum ChunkIndex {
+            GPR_CHUNK,
+            X87_CHUNK,
+            VECTOR_CHUNK,
+            FLAGS_CHUNK,
+
+            CHUNKS_COUNT,
+        };
+
+        struct Chunk {
+            size_t references;
+            size_t size;
+
+            // Values are placed right after the header
+            inline Value *values()
+            {
+                return reinterpret_cast<Value *>(this + 1);
+            }
+            inline Value const *values() const
+            {
+                return reinterpret_cast<Value const *>(this + 1);
+            }
+
+            static Chunk *make(utils::Pool *pool, size_t size);
+            static Chunk *copy(utils::Pool *pool, Chunk const &chunk);
+            static void release(utils::Pool *pool, Chunk *chunk);
         };
 
-        void initialize_holder(Holder &holder, size_t begin, size_t end);
+        inline Value const &value_at(Reg reg) const
+        {
+            auto const &chunk = *chunks_[chunk_index_[reg]];
+            return chunk.values()[reg - chunk_begin_[reg]];
+        }
+        Value &modify(Reg reg);
 
-        std::shared_ptr<void> holder_;
+        static std::optional<Reg> lookup(ZydisRegister zydis_reg);
 
+        utils::Pool *pool_;
+        std::array<Chunk *, CHUNKS_COUNT> chunks_;
+
+        static constexpr Reg chunk_bounds_[CHUNKS_COUNT + 1] = {
+            RAX,
+            X87CONTROL,
+            ZMM0,
+            RFLAGS,
+            REGISTERS_COUNT,
+        };
+        static const std::array<ChunkIndex, REGISTERS_COUNT> chunk_index_;
+        static const std::array<Reg, REGISTERS_COUNT> chunk_begin_;
+        // Zydis register -> promoted Reg, REGISTERS_COUNT if not tracked
+        static const std::array<Reg, ZYDIS_REGISTER_MAX_VALUE + 1> lookup_;
+        static const std::array<ZydisRegister, REGISTERS_COUNT> zydis_;
         static const std::unordered_map<ZydisRegister, ZydisRegister>
             reg_promotion_map_;
         static const std::unordered_set<ZydisRegister> legacy_ho_part_;
@@ -3,19 +3,68 @@
 using namespace rstc;
 using namespace rstc::virt;
 
-std::atomic<uintptr_t> Value::Symbol::next_id_ = 1;
+std::atomic<uintptr_t> Value::Symbol::next_id_block_ = 1;
+Address Value::source_base_ = nullptr;
 
 Value::Symbol::Symbol(uintptr_t id, intptr_t offset)
-    : id_(id ? id : next_id_++)
+    : id_(id ? id : allocate_id())
     , offset_(offset)
 {
 }
 
+uintptr_t Value::Symbol::allocate_id()
+{
+    thread_local uintptr_t next_id = 0;
+    thread_local uintptr_t end_id = 0;
+    if (next_id == end_id) {
+        next_id = next_id_block_.fetch_add(id_block_size_,
+                                           std::memory_order_relaxed);
+        end_id = next_id + id_block_size_;
+    }
+    return next_id++;
+}
+
 Value::Value(Address source, ValueContainer value, int size)
-    : source_(source)
-    , value_(std::move(value))
-    , size_(size)
 {
+    set_source(source);
+    if (auto symbol = std::get_if<Symbol>(&value); symbol) {
+        // Only the low 32 bits of offsets are part of `raw_value`
+        payload_ = symbol->id() & id_mask_;
+        offset_ = static_cast<int32_t>(symbol->offset());
+        symbolic_ = true;
+    }
+    else {
+        payload_ = std::get<uintptr_t>(value);
+        symbolic_ = false;
+    }
+    set_size(size);
+}
+
+void Value::set_source(Address source)
+{
+    if (!source) {
+        source_ = 0;
+        return;
+    }
+    assert(source_base_ && source >= source_base_
+           && source - source_base_ < 0x7FFFFFFF);
+    source_ = static_cast<uint32_t>(source - source_base_) + 1;
+}
+
+void Value::set_size(int size)
+{
+    assert(size >= 0 && size < 0x100);
+    if (symbolic_) {
+        payload_ = (payload_ & id_mask_) | (uintptr_t(size) << id_bits_);
+    }
+    else {
+        offset_ = size;
+    }
+}
+
+void Value::set_source_base(Address base)
+{
+    source_base_ = base;
 }
 
 Value rstc::virt::make_value(Address source, uintptr_t value, int size)
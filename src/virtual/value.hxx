@@ -3,6 +3,8 @@
 #include "core.hxx"
 
 #include <atomic>
+#include <cassert>
+#include <cstdint>
 #include <compare>
 #include <optional>
 #include <variant>
@@ -19,9 +21,25 @@ namespace rstc::virt {
             inline intptr_t offset() const { return offset_; }
 
         private:
+            struct Existing {};
+
+            // Doesn't allocate an id, even if `id` is 0
+            inline Symbol(Existing, uintptr_t id, intptr_t offset)
+                : id_(id)
+                , offset_(offset)
+            {
+            }
+
+            static uintptr_t allocate_id();
+
             uintptr_t id_;
             intptr_t offset_;
-            static std::atomic<uintptr_t> next_id_;
+
+            // Ids are handed out to threads in blocks
+            static constexpr uintptr_t id_block_size_ = 4096;
+            static std::atomic<uintptr_t> next_id_block_;
+
+            friend class Value;
         };
 
         using ValueContainer = std::variant<uintptr_t, Symbol>;
@@ -30,34 +48,42 @@ namespace rstc::virt {
                        ValueContainer value = Symbol(),
                        int size = 8);
 
-        inline bool is_symbolic() const
+        inline bool is_symbolic() const { return symbolic_; }
+
+        inline Address source() const
         {
-            return std::holds_alternative<Symbol>(value_);
+            return source_ ? source_base_ + (source_ - 1) : nullptr;
+        }
+        inline uintptr_t value() const
+        {
+            assert(!symbolic_);
+            return payload_;
+        }
+        inline Symbol symbol() const
+        {
+            assert(symbolic_);
+            return Symbol(Symbol::Existing(), payload_ & id_mask_, offset_);
+        }
+        inline int size() const
+        {
+            return symbolic_ ? static_cast<int>(payload_ >> id_bits_)
+                             : offset_;
         }
 
-        inline Address source() const { return source_; }
-        inline uintptr_t value() const { return std::get<uintptr_t>(value_); }
-        inline Symbol symbol() const { return std::get<Symbol>(value_); }
-        inline int size() const { return size_; }
-
-        inline void set_source(Address source) { source_ = source; }
-        inline void set_size(int size) { size_ = size; }
+        void set_source(Address source);
+        void set_size(int size);
 
         inline uintptr_t raw_value() const
         {
-            if (is_symbolic()) {
-                auto const &s = symbol();
-                return (s.id() << 32) | (s.offset() & 0xFFFFFFFF);
+            if (symbolic_) {
+                return (payload_ << 32) | (uintptr_t(offset_) & 0xFFFFFFFF);
             }
-            return value();
+            return payload_;
         }
 
         inline uintptr_t raw_address_value() const
         {
-            if (is_symbolic()) {
-                return symbol().id();
-            }
-            return value();
+            return symbolic_ ? payload_ & id_mask_ : payload_;
         }
 
         inline auto operator<=>(Value const &rhs) const
@@ -71,12 +97,28 @@ namespace rstc::virt {
             return raw_value() == rhs.raw_value();
         }
 
+        // Sources are stored as 32-bit offsets from the mapped image
+        static void set_source_base(Address base);
+
+        // Symbol ids keep their low 56 bits
+        static constexpr int id_bits_ = 56;
+        static constexpr uintptr_t id_mask_ = (uintptr_t(1) << id_bits_) - 1;
+
     private:
-        Address source_;
-        ValueContainer value_;
-        int size_;
+        // Concrete value, or symbol id with the size in the high byte
+        uintptr_t payload_;
+        // Offset of the source from `source_base_` + 1, 0 for no source.
+        // Images are limited to 2GB, so 31 bits are enough.
+        uint32_t source_ : 31;
+        uint32_t symbolic_ : 1;
+        // Symbol offset, or the size of a concrete value
+        int32_t offset_;
+
+        static Address source_base_;
     };
 
+    static_assert(sizeof(Value) == 16);
+
     Value make_value(Address source, uintptr_t value, int size = 8);
     Value make_symbolic_value(Address source,
                               int size = 8,